@@ -0,0 +1,21 @@
+/*
+Allocation counter. A debug aid for keeping the CV loop free of heap
+allocations. When built with COUNT_FRAME_ALLOCATIONS, global operator new and
+OpenCV's image buffer allocator are replaced with versions that count
+allocations per thread. Otherwise everything here does nothing.
+*/
+
+#pragma once
+
+#include <cstdint>
+
+namespace allocation_counter {
+    // True when built with COUNT_FRAME_ALLOCATIONS
+    bool is_enabled();
+
+    // Routes OpenCV image buffers through the counter. Call once at start up.
+    void install();
+
+    // Heap allocations made by the calling thread so far. Always 0 when not enabled.
+    uint64_t thread_count();
+}
@@ -0,0 +1,67 @@
+/*
+Camera model. Maps webcam pixels to the angle they are seen at, taking lens
+distortion into account. Angles are precomputed on a grid whenever the camera
+model changes, so the CV thread only does a table lookup per eye.
+
+The model comes from a checkerboard calibration saved in
+camera_intrinsics.yml if there is one, otherwise from the field of view
+measured in the QR code calibration, which assumes an undistorted lens.
+*/
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <opencv2/core.hpp>
+
+const char* const CAMERA_INTRINSICS_FILE = "camera_intrinsics.yml";
+
+struct camera_intrinsics {
+    cv::Size image_size;
+    cv::Matx33d camera_matrix;
+    cv::Mat distortion; // k1, k2, p1, p2, k3
+};
+
+// Horizontal and vertical angle of every pixel, sampled on a grid and
+// bilinearly interpolated between samples
+class angle_lookup_table {
+public:
+    angle_lookup_table(const camera_intrinsics& intrinsics, int cell_size);
+
+    // Angles in degrees from the optical axis. Right and down are positive.
+    cv::Point2d angles_at(cv::Point2f pixel) const;
+
+    cv::Size image_size() const;
+
+private:
+    cv::Size size;
+    int cell_size;
+    int grid_columns;
+    int grid_rows;
+    std::vector<cv::Point2f> grid_angles; // Row major
+};
+
+namespace camera_model {
+    // Size of the webcam frames. The lookup table is built once this and a
+    // camera model are known, and rebuilt if the size changes. The CV loop
+    // calls this whenever a frame comes in at a new size.
+    void set_frame_size(cv::Size frame_size);
+
+    // Pinhole model with no distortion, from the measured horizontal field
+    // of view. Not used if a checkerboard calibration was loaded.
+    void use_horizontal_fov(double horizontal_fov_deg);
+
+    // Loads a checkerboard calibration. Returns false if there is none.
+    bool load_intrinsics(const std::string& path);
+
+    // Calibrates from photos of a checkerboard with the given number of inner
+    // corners, and saves the result. Returns false if the board was not found
+    // in enough photos.
+    bool calibrate_from_checkerboard(const std::vector<std::string>& image_paths, cv::Size pattern_size, const std::string& save_path);
+
+    // Angles of a pixel in degrees. Falls back to an undistorted pinhole
+    // camera if there is no lookup table for this frame size yet.
+    cv::Point2d angles_at(cv::Point2f pixel, cv::Size frame_size);
+}
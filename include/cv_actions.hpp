@@ -8,23 +8,65 @@ CV Actions. Captures from webcam and processes them.
 #include <opencv2/highgui/highgui.hpp>
 #include <opencv2/objdetect.hpp>
 #include <cmath>
-#include <tuple>
+#include <chrono>
 
 
-const float SEARCH_AREA_SIZE = 1.5f;
+const float SEARCH_AREA_SIZE = 1.5f; // Default, the quality governor may change it
+
+// Search area sides are rounded up to a multiple of this, so the detector's
+// input size only changes when the face moves a good way nearer or further
+const int SEARCH_AREA_STEP = 32;
 
 namespace cv_actions {
-    // Capture a frame from the webcam
-    // Returns false if either unsuccessful or no face detected
+    // Per frame measurements from detect_face, used for the pose log
+    struct face_detection_stats {
+        cv::Rect search_bounds; // Area searched this frame
+        float confidence = 0;
+        double capture_ms = 0; // Filled in by the caller, detect_face does not capture
+        double detect_ms = 0;
+    };
+
+    // Images reused from frame to frame, so tracking does not allocate once
+    // the sizes settle
+    struct face_detection_buffers {
+        cv::Mat scaled_search_area;
+        cv::Mat detections;
+    };
+
+    // What detect_face drew on its frame. Kept so frames the detector skips
+    // can show the last face found instead of nothing.
+    struct face_markers {
+        bool has_face = false;
+        cv::Rect search_bounds;
+        cv::Rect face_rect;
+        cv::Point2f left_eye_position;
+        cv::Point2f right_eye_position;
+    };
+
+    // Draws the search area, face and eyes. Does nothing if there is no face.
+    void draw_face_markers(cv::Mat& frame, const face_markers& markers);
+
+    // Finds the face in a frame captured from the webcam, and draws it on the frame
+    // Returns false if no face detected
     bool detect_face(
         cv::Ptr<cv::FaceDetectorYN>& face_model_pointer,
         cv::Rect& bounding_box,
-        cv::VideoCapture& cap,
         cv::Mat& out_frame,
-        std::tuple<double, double>& left_eye_position_proportion_from_center,
-        std::tuple<double, double>& right_eye_position_proportion_from_center
+        cv::Point2f& left_eye_position, // Pixel position in the frame
+        cv::Point2f& right_eye_position,
+        float detector_scale, // Search area is shrunk by this before detection, 1 for full resolution
+        float search_area_size, // Next search area relative to the face found
+        face_detection_buffers& buffers,
+        face_detection_stats& stats,
+        face_markers& markers // Filled in with what was drawn
     );
 
+    // Side of the next search area, rounded up to a multiple of
+    // SEARCH_AREA_STEP and at most frame_side. Keeps the previous side when
+    // the face has only shrunk by less than a step, so the detector input
+    // size does not flicker between two steps. Pass 0 if there is none.
+    int stable_search_side(int needed_side, int previous_side, int frame_side);
+
     bool detect_qr(
         cv::VideoCapture& cap,
         cv::Mat& out_frame,
@@ -8,6 +8,7 @@
 
 #include "gtk_signal_data.hpp"
 #include "shared.hpp"
+#include "renderer_server.hpp"
 
 const float QR_CODE_WIDTH = 6;
 
@@ -0,0 +1,44 @@
+/*
+Frame pool. Webcam frames are shown in GTK as textures over BGR buffers taken
+from a pool. A buffer goes back to the pool when GTK drops the last texture
+using it, so once enough buffers are in flight the CV thread stops allocating
+them.
+*/
+
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <gtk/gtk.h>
+#include <opencv2/core/mat.hpp>
+
+class frame_pool {
+public:
+    // Buffers are made as needed, this many are expected to be in flight
+    explicit frame_pool(size_t expected_buffers);
+
+    frame_pool(const frame_pool&) = delete;
+    frame_pool& operator=(const frame_pool&) = delete;
+
+    // Copies a BGR frame into a texture over a pooled buffer. The pool must
+    // outlive every texture it hands out.
+    GdkPaintable* to_paintable(const cv::Mat& bgr_frame);
+
+    // Buffers made so far
+    size_t size();
+
+private:
+    struct buffer {
+        frame_pool* pool;
+        cv::Mat bgr;
+    };
+
+    // GBytes free function, called on whichever thread drops the texture
+    static void release(gpointer data);
+
+    std::mutex mutex;
+    std::vector<std::unique_ptr<buffer>> buffers;
+    std::vector<buffer*> free_buffers; // Capacity kept at buffers.size(), so releasing never allocates
+};
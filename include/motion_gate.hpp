@@ -0,0 +1,29 @@
+/*
+Motion gate. Decides whether a frame is worth running the face detector on.
+Each frame is shrunk to a small greyscale thumbnail and the search area is
+compared against the thumbnail from the last frame the detector ran on. If
+too few pixels changed, the last pose still holds and detection is skipped.
+
+Detection always runs until the eye angle filter has settled on a still
+pose, and at least every FORCED_DETECTION_INTERVAL_MS, so a change the
+thumbnail misses is only ever briefly stale.
+*/
+
+#pragma once
+
+#include <opencv2/core/mat.hpp>
+
+namespace motion_gate {
+    // On by default. When off every frame is detected.
+    void set_enabled(bool is_enabled);
+
+    // True if the search area has not changed since the detector last ran, so
+    // detection can be skipped. A false return means the caller will run the
+    // detector, and this frame becomes the new reference.
+    // Only call from the CV thread.
+    bool is_static(const cv::Mat& frame, const cv::Rect& search_bounds);
+
+    // Forgets the reference frame, so the next frame is always detected. Call
+    // when the frame size changes. Only call from the CV thread.
+    void reset();
+}
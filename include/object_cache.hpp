@@ -0,0 +1,82 @@
+/*
+Object cache. Converts a selected model once into a compact binary file named
+after the hash of its contents, so switching subjects only has to map a file
+instead of parsing the model again. Recently used subjects are read ahead in
+the background at start up, so they are likely in the page cache when the
+renderer maps them.
+
+Cache file layout, all little endian, each section aligned to 16 bytes:
+    object_cache_header
+    object_cache_vertex * vertex_count
+    uint32_t * index_count (triangles)
+    uint8_t * texture_width * texture_height * 4 (RGBA)
+
+Only Wavefront OBJ models with at most one material, and the opaque diffuse
+texture of that material if there is one, are converted. Models with several
+materials or a texture with an alpha channel, and other formats, are still
+sent to the renderer by path, and so is everything unless the renderer is
+known to read cache files (request code 7).
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+const char OBJECT_CACHE_MAGIC[8] = {'O', 'B', 'J', 'C', 'A', 'C', 'H', 'E'};
+const uint32_t OBJECT_CACHE_VERSION = 1;
+
+// Flags for object_cache_header::flags
+const uint32_t OBJECT_CACHE_HAS_MESH = 1 << 0;
+const uint32_t OBJECT_CACHE_HAS_TEXTURE = 1 << 1;
+
+struct object_cache_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t flags;
+    uint64_t content_hash; // Hash of the model, its material library and texture
+    uint64_t vertex_count;
+    uint64_t vertex_offset;
+    uint64_t index_count;
+    uint64_t index_offset;
+    uint32_t texture_width;
+    uint32_t texture_height;
+    uint64_t texture_offset;
+};
+
+struct object_cache_vertex {
+    float position[3];
+    float normal[3];
+    float uv[2];
+};
+
+static_assert(sizeof(object_cache_header) == 72, "object_cache_header layout changed");
+static_assert(sizeof(object_cache_vertex) == 32, "object_cache_vertex layout changed");
+
+namespace object_cache {
+    // Off by default, subjects are then always sent by path with request
+    // code 6. Turn on for renderers that read cache files. Call before start.
+    void set_renderer_cache_enabled(bool is_enabled);
+
+    // Does nothing unless renderers read cache files. Otherwise starts the
+    // cache thread, deletes cache files no longer in use and prefetches
+    // recently used subjects.
+    void start();
+
+    // Stops the cache thread. Anything still queued is dropped.
+    void stop();
+
+    // Makes sure the model has an up to date cache file, then tells the
+    // renderers to display it. Returns immediately, the work runs on the
+    // cache thread. Without renderer cache support the model is sent by path
+    // straight away.
+    void display(const std::string& model_path);
+
+    // Converts a model into a cache file. Returns false if the model could
+    // not be read or is not a format that can be converted.
+    bool build(const std::string& model_path, const std::string& cache_path, uint64_t content_hash);
+
+    // FNV-1a hash of a file's contents. Pass the hash of another file to hash
+    // several files together.
+    uint64_t hash_file(const std::string& path, uint64_t hash = 14695981039346656037ULL);
+}
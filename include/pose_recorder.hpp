@@ -0,0 +1,88 @@
+/*
+Pose recorder. Appends a fixed size binary record for every tracked frame to a
+log file, and reads those logs back through a memory mapping for replay.
+
+File layout, all little endian:
+    pose_log_header
+    pose_record * N
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+const char POSE_LOG_MAGIC[8] = {'P', 'O', 'S', 'E', 'L', 'O', 'G', '\0'};
+const uint32_t POSE_LOG_VERSION = 1;
+
+// Flags for pose_record::flags
+const uint32_t POSE_RECORD_HAS_POSE = 1 << 0;
+
+struct pose_log_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    int64_t start_unix_time_ns; // Wall clock time the log was opened, record timestamps count from here
+};
+
+struct pose_record {
+    int64_t timestamp_ns; // Time since the recording started
+    double raw_eye_angles[4]; // Left horizontal, left vertical, right horizontal, right vertical
+    double filtered_eye_angles[4]; // What was sent to the renderer
+    int32_t search_bounds[4]; // x, y, width, height
+    float confidence;
+    float capture_ms;
+    float detect_ms;
+    float total_ms;
+    uint32_t flags;
+    uint32_t quality_level; // See quality_governor
+};
+
+static_assert(sizeof(pose_log_header) == 24, "pose_log_header layout changed");
+static_assert(sizeof(pose_record) == 112, "pose_record layout changed");
+
+namespace pose_recorder {
+    // Opens the log file and starts the background flush thread. The log stops
+    // growing at 64 MB, and only the newest session logs are kept in its
+    // directory. Returns false if the file could not be opened.
+    bool start(const std::string& path);
+
+    // Queues a record. Never blocks, the record is dropped if the queue is full.
+    // Does nothing if not recording.
+    // Only call from one thread, the CV thread.
+    void record(pose_record& record);
+
+    // Flushes anything queued and closes the log file.
+    void stop();
+
+    // Sends the poses in a log to the renderer at their original timing,
+    // counted from the first pose. When refiltered, the raw poses are run
+    // through the current eye angle filter instead of sending the filtered
+    // poses as recorded, so filter changes can be compared. Runs on the CV
+    // thread in place of the webcam loop, and returns soon after
+    // do_cv_thread_run is cleared.
+    void replay(const std::string& path, bool is_refiltered);
+
+    // Default log file name for a session started now
+    std::string default_log_path();
+}
+
+// Read only view of a pose log through a memory mapping
+class pose_log_reader {
+public:
+    // Throws std::runtime_error if the file is not a valid pose log.
+    explicit pose_log_reader(const std::string& path);
+
+    const pose_log_header& header() const;
+    size_t size() const;
+    const pose_record& operator[](size_t index) const;
+
+private:
+    boost::interprocess::file_mapping file;
+    boost::interprocess::mapped_region region;
+    const pose_record* records = nullptr;
+    size_t record_count = 0;
+};
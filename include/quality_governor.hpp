@@ -0,0 +1,34 @@
+/*
+Quality governor. Watches how long each frame takes to process against a
+latency budget, and steps detection quality down when frames run over or up
+when there is room to spare. Steps are taken with hysteresis, so the level
+does not flicker around the budget.
+*/
+
+#pragma once
+
+#include <string>
+
+struct quality_decision {
+    int level; // 0 is the highest quality
+    float detector_scale; // Search area is resized by this before detection
+    float search_area_size; // Search area around the last face, relative to the face size
+    int detection_interval; // Run the detector every this many frames
+    int preview_interval; // Update the webcam preview every this many frames
+};
+
+namespace quality_governor {
+    // Frames slower than this step quality down. Defaults to 20 ms.
+    void set_latency_budget_ms(double budget_ms);
+
+    // Feeds the processing time of one frame the detector ran on. Frames it
+    // skipped would understate the cost of the level. Returns true if the
+    // decision changed.
+    // Only call from the CV thread.
+    bool report_frame_time(double frame_ms);
+
+    // Safe to call from any thread
+    quality_decision current();
+
+    std::string describe(const quality_decision& decision);
+}
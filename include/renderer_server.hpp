@@ -0,0 +1,56 @@
+/*
+Renderer socket server. Accepts any number of renderer connections and fans
+every message out to all of them.
+
+Each client has its own send queue and is written to asynchronously on the
+server thread, so a stalled renderer only backs up its own queue. Eye angle
+messages are latest-wins: a client that falls behind skips straight to the
+newest pose instead of working through a backlog. Other messages are always
+delivered in order, but a client that lets too many of them pile up is
+disconnected.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace renderer_server {
+    // Binds the socket server and starts the server thread. Call just before
+    // spawning the renderer.
+    void start();
+
+    // Sends the quit request to every client, waits briefly for it to be
+    // delivered, then stops the server thread.
+    void shutdown();
+
+    // Queues a message for every connected client.
+    void send(std::vector<uint8_t> message);
+
+    // Like send, but the message is also sent to clients that connect later.
+    // Only the newest message for each key is kept. The key defaults to the
+    // request code, messages that replace each other share a key.
+    void send_and_remember(std::vector<uint8_t> message, int64_t remember_key = -1);
+
+    // Sends request code 4 followed by the four angles. Only the newest pose
+    // is kept if several arrive before the server thread gets to them, and
+    // nothing is allocated, so it is safe to call every frame.
+    void send_eye_angles(const double eye_angles[4]);
+
+    size_t client_count();
+
+    // Starts a message with its request code
+    std::vector<uint8_t> make_message(int64_t request_code);
+
+    // Appends the raw bytes of a value to a message. All values are little endian.
+    template <typename T>
+    void append(std::vector<uint8_t>& message, const T& value) {
+        const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&value);
+        message.insert(message.end(), bytes, bytes + sizeof(T));
+    }
+
+    inline void append(std::vector<uint8_t>& message, const std::string& value) {
+        message.insert(message.end(), value.begin(), value.end());
+    }
+}
@@ -11,23 +11,30 @@
 
 #include <boost/asio.hpp>
 #include <boost/process.hpp>
+#include <boost/circular_buffer.hpp>
 
 #include <mutex>
 #include <atomic>
 #include <thread>
 #include <fstream>
 #include <iostream>
-#include <queue>
+
+#include "triple_buffer.hpp"
+
+// Latest webcam preview from the CV thread, handed to the GTK thread. Poses
+// go straight to the renderer, the GTK thread has no use for them.
+struct tracking_snapshot {
+    GdkPaintable* paintable = nullptr;
+};
 
 namespace shared_vars {
     extern GtkApplication* app;
     extern GtkWidget* main_window;
 
-    extern GdkPaintable* webcam_paintable;
+    extern triple_buffer<tracking_snapshot> tracking_snapshots;
 
     extern GtkBuilder *builder;
 
-    extern std::mutex webcam_paintable_mutex;
     extern cv::VideoCapture webcam_capture;
     extern Glib::Dispatcher webcam_dispatcher;
     extern cv::Ptr<cv::FaceDetectorYN> face_detector_pointer;
@@ -46,21 +53,20 @@ namespace shared_vars {
     extern GtkEditable* vertical_displacement_editable;
 
     extern std::thread cv_process_thread;
-    extern bool is_current_cv_action_face;
+    extern std::atomic<bool> is_current_cv_action_face;
     extern std::atomic<bool> do_cv_thread_run;
 
     extern boost::asio::io_context io_context;
-    extern boost::asio::ip::tcp::socket renderer_socket;
     extern boost::asio::ip::tcp::endpoint endpoint;
     extern boost::asio::ip::tcp::acceptor acceptor;
 
-    extern bool is_renderer_active;
+    extern std::atomic<bool> is_renderer_active; // At least one renderer is connected
 
     extern int BUFFER_SIZE;
-    extern std::queue<double> left_eye_horizontal_angle_buffer;
-    extern std::queue<double> right_eye_horizontal_angle_buffer;
-    extern std::queue<double> left_eye_vertical_angle_buffer;
-    extern std::queue<double> right_eye_vertical_angle_buffer;
+    extern boost::circular_buffer<double> left_eye_horizontal_angle_buffer;
+    extern boost::circular_buffer<double> right_eye_horizontal_angle_buffer;
+    extern boost::circular_buffer<double> left_eye_vertical_angle_buffer;
+    extern boost::circular_buffer<double> right_eye_vertical_angle_buffer;
     extern double left_eye_horizontal_angle_buffer_sum;
     extern double right_eye_horizontal_angle_buffer_sum;
     extern double left_eye_vertical_angle_buffer_sum;
@@ -69,18 +75,24 @@ namespace shared_vars {
 
     extern boost::process::child* renderer_program;
 
-    void listen_for_renderer_socket_and_call_dispatcher(); // Run this in a new thread, because socket accept blocks.
+    void send_settings_to_renderer(); // Sends request code 2 with the calibrated settings, also to renderers that connect later
+
+    // Pushes raw eye angles into the moving average buffers and returns the
+    // averages. Angles are left horizontal, left vertical, right horizontal,
+    // right vertical. Used by the CV loop and by raw replays, so both filter
+    // the same way. Only call from the CV thread.
+    void filter_eye_angles(const double raw_eye_angles[4], double filtered_eye_angles[4]);
 }
 
 namespace working_parameters {
     extern float qr_code_distance;
-    extern float qr_code_inverse_proportion;
+    extern std::atomic<float> qr_code_inverse_proportion;
     extern float lenticule_density;
     extern float green_to_red_line_distance;
 }
 
 namespace parameters {
-    extern float webcam_fov_deg;
-    extern float pixels_per_lens;
-    extern float index_of_refraction;
+    extern std::atomic<float> webcam_fov_deg;
+    extern std::atomic<float> pixels_per_lens;
+    extern std::atomic<float> index_of_refraction;
 }
\ No newline at end of file
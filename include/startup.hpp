@@ -0,0 +1,50 @@
+/*
+Startup orchestration. Runs the slow parts of start up (webcam, face detector,
+calibration file, renderer) concurrently and logs a timeline of when each one
+finished.
+*/
+
+#pragma once
+
+#include <opencv2/core/types.hpp>
+
+#include <chrono>
+#include <future>
+#include <string>
+#include <vector>
+
+namespace startup {
+    // Each of these resolves to true when the step succeeded.
+    extern std::shared_future<bool> webcam_ready;
+    extern std::shared_future<bool> face_detector_ready;
+    extern std::shared_future<bool> calibration_ready;
+
+    // Starts the timeline clock. Call this before anything else in activate.
+    void begin();
+
+    // Logs an event on the startup timeline, relative to begin().
+    void mark(const std::string& event);
+
+    // Same as mark, but only logs the first time it is called with this event.
+    // Does not allocate after the first call, so it is safe in the CV loop.
+    void mark_once(const char* event);
+
+    // Opens the webcam, loads and warms up the face detector and reads the
+    // calibration file on worker threads. Returns immediately. Loaded
+    // calibration settings are queued for the renderer.
+    void launch_background_tasks();
+
+    // Starts the renderer socket server and spawns the renderer process. The
+    // app quits when that process exits.
+    void start_renderer();
+
+    // Blocks until the webcam, the warmed up face detector and the calibration
+    // settings are ready. Returns false if the face detector could not be
+    // loaded. Called on the CV thread before it enters its loop.
+    bool wait_for_cv_dependencies();
+
+    // Region of interest sizes the detector is warmed up with, in the order
+    // they are run, given the size of a webcam frame. Ends with the full
+    // frame, which is the first real search.
+    std::vector<cv::Size> warm_up_sizes(cv::Size frame_size);
+}
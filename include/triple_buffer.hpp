@@ -0,0 +1,52 @@
+/*
+Lock-free triple buffer. Hands the latest value from a single writer thread to
+a single reader thread. Neither side ever waits on the other, and the reader
+always gets the newest value that has been published.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+template <typename T>
+class triple_buffer {
+public:
+    // Slot the writer fills before calling publish. Only touch from the writer thread.
+    T& back() {
+        return slots[back_index];
+    }
+
+    // Makes the back slot visible to the reader, and takes the old middle slot
+    // as the new back slot.
+    void publish() {
+        uint8_t previous = middle.exchange(back_index | DIRTY_BIT, std::memory_order_acq_rel);
+        back_index = previous & INDEX_MASK;
+    }
+
+    // Swaps in the newest published value if there is one. Returns false if
+    // nothing was published since the last call. Only call from the reader thread.
+    bool acquire() {
+        if (!(middle.load(std::memory_order_relaxed) & DIRTY_BIT)) {
+            return false;
+        }
+
+        uint8_t previous = middle.exchange(front_index, std::memory_order_acq_rel);
+        front_index = previous & INDEX_MASK;
+        return true;
+    }
+
+    // Slot the reader got from the last acquire. Only touch from the reader thread.
+    T& front() {
+        return slots[front_index];
+    }
+
+private:
+    static constexpr uint8_t DIRTY_BIT = 0x4;
+    static constexpr uint8_t INDEX_MASK = 0x3;
+
+    T slots[3] = {};
+    uint8_t back_index = 0;
+    std::atomic<uint8_t> middle{1};
+    uint8_t front_index = 2;
+};
@@ -0,0 +1,129 @@
+#include "allocation_counter.hpp"
+
+#ifdef COUNT_FRAME_ALLOCATIONS
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+#include <opencv2/core/mat.hpp>
+
+// Per thread, so GTK and the server thread do not muddy the CV thread's count
+static thread_local uint64_t thread_allocation_count = 0;
+
+// Set while OpenCV's allocator runs, which news the UMatData header of the
+// Mat it has already been counted for
+static thread_local bool is_in_mat_allocate = false;
+
+static void* counted_allocate(std::size_t size, std::size_t alignment) {
+    if (!is_in_mat_allocate) thread_allocation_count++;
+    if (size == 0) size = 1;
+
+    while (true) {
+        void* pointer = alignment > alignof(std::max_align_t)
+            ? std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment)
+            : std::malloc(size);
+        if (pointer) return pointer;
+
+        std::new_handler handler = std::get_new_handler();
+        if (!handler) throw std::bad_alloc();
+        handler();
+    }
+}
+
+void* operator new(std::size_t size) {
+    return counted_allocate(size, 0);
+}
+
+void* operator new[](std::size_t size) {
+    return counted_allocate(size, 0);
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment) {
+    return counted_allocate(size, (std::size_t)alignment);
+}
+
+void* operator new[](std::size_t size, std::align_val_t alignment) {
+    return counted_allocate(size, (std::size_t)alignment);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+    try {
+        return counted_allocate(size, 0);
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept {
+    try {
+        return counted_allocate(size, 0);
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+void operator delete(void* pointer) noexcept { std::free(pointer); }
+void operator delete[](void* pointer) noexcept { std::free(pointer); }
+void operator delete(void* pointer, std::size_t) noexcept { std::free(pointer); }
+void operator delete[](void* pointer, std::size_t) noexcept { std::free(pointer); }
+void operator delete(void* pointer, std::align_val_t) noexcept { std::free(pointer); }
+void operator delete[](void* pointer, std::align_val_t) noexcept { std::free(pointer); }
+void operator delete(void* pointer, std::size_t, std::align_val_t) noexcept { std::free(pointer); }
+void operator delete[](void* pointer, std::size_t, std::align_val_t) noexcept { std::free(pointer); }
+
+// OpenCV allocates image buffers with malloc rather than new, so they are
+// counted here. Each call counts once, for the buffer and the UMatData
+// header together. Buffers are still freed by the standard allocator, which
+// OpenCV records as their owner.
+class counting_mat_allocator : public cv::MatAllocator {
+public:
+    cv::UMatData* allocate(int dims, const int* sizes, int type, void* data, size_t* step, cv::AccessFlag flags, cv::UMatUsageFlags usage) const override {
+        thread_allocation_count++;
+        is_in_mat_allocate = true;
+        try {
+            cv::UMatData* mat_data = cv::Mat::getStdAllocator()->allocate(dims, sizes, type, data, step, flags, usage);
+            is_in_mat_allocate = false;
+            return mat_data;
+        } catch (...) {
+            is_in_mat_allocate = false;
+            throw;
+        }
+    }
+
+    bool allocate(cv::UMatData* data, cv::AccessFlag flags, cv::UMatUsageFlags usage) const override {
+        return cv::Mat::getStdAllocator()->allocate(data, flags, usage);
+    }
+
+    void deallocate(cv::UMatData* data) const override {
+        cv::Mat::getStdAllocator()->deallocate(data);
+    }
+};
+
+static counting_mat_allocator mat_allocator;
+
+bool allocation_counter::is_enabled() {
+    return true;
+}
+
+void allocation_counter::install() {
+    cv::Mat::setDefaultAllocator(&mat_allocator);
+}
+
+uint64_t allocation_counter::thread_count() {
+    return thread_allocation_count;
+}
+
+#else
+
+bool allocation_counter::is_enabled() {
+    return false;
+}
+
+void allocation_counter::install() {}
+
+uint64_t allocation_counter::thread_count() {
+    return 0;
+}
+
+#endif
@@ -0,0 +1,240 @@
+#include "camera_model.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <iostream>
+#include <mutex>
+
+#include <opencv2/calib3d.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include "shared.hpp"
+
+// Pixels between lookup table samples. Distortion changes slowly across the
+// frame, so this loses nothing measurable against per pixel tables.
+const int LOOKUP_TABLE_CELL_SIZE = 8;
+
+// Photos the board has to be found in before a calibration is trusted
+const int MINIMUM_CHECKERBOARD_VIEWS = 5;
+
+const double DEGREES_PER_RADIAN = 180.0 / 3.141592653589793238463;
+
+// Swapped in whole by whichever thread changes the camera model, read
+// lock free by the CV thread
+static std::shared_ptr<const angle_lookup_table> current_lookup_table;
+
+// Guards everything below
+static std::mutex camera_model_mutex;
+static cv::Size current_frame_size;
+static double current_horizontal_fov_deg = 0;
+static bool is_from_checkerboard = false;
+static camera_intrinsics checkerboard_intrinsics;
+
+angle_lookup_table::angle_lookup_table(const camera_intrinsics& intrinsics, int cell_size) :
+    size(intrinsics.image_size),
+    cell_size(cell_size)
+{
+    // One sample past the last pixel so every pixel has four neighbours
+    grid_columns = size.width / cell_size + 2;
+    grid_rows = size.height / cell_size + 2;
+
+    std::vector<cv::Point2f> grid_pixels;
+    grid_pixels.reserve(grid_columns * grid_rows);
+    for (int row = 0; row < grid_rows; row++) {
+        for (int column = 0; column < grid_columns; column++) {
+            grid_pixels.emplace_back((float)(column * cell_size), (float)(row * cell_size));
+        }
+    }
+
+    // Normalised image coordinates, x and y divided by depth, with distortion removed
+    std::vector<cv::Point2f> normalised;
+    cv::undistortPoints(grid_pixels, normalised, intrinsics.camera_matrix, intrinsics.distortion);
+
+    grid_angles.reserve(normalised.size());
+    for (const cv::Point2f& point : normalised) {
+        grid_angles.emplace_back(
+            (float)(std::atan(point.x) * DEGREES_PER_RADIAN),
+            (float)(std::atan(point.y) * DEGREES_PER_RADIAN)
+        );
+    }
+}
+
+cv::Point2d angle_lookup_table::angles_at(cv::Point2f pixel) const {
+    float grid_x = std::clamp(pixel.x / cell_size, 0.0f, (float)(grid_columns - 1) - 1e-3f);
+    float grid_y = std::clamp(pixel.y / cell_size, 0.0f, (float)(grid_rows - 1) - 1e-3f);
+
+    int column = (int)grid_x;
+    int row = (int)grid_y;
+    float x_weight = grid_x - column;
+    float y_weight = grid_y - row;
+
+    const cv::Point2f& top_left = grid_angles[row * grid_columns + column];
+    const cv::Point2f& top_right = grid_angles[row * grid_columns + column + 1];
+    const cv::Point2f& bottom_left = grid_angles[(row + 1) * grid_columns + column];
+    const cv::Point2f& bottom_right = grid_angles[(row + 1) * grid_columns + column + 1];
+
+    cv::Point2f top = top_left + (top_right - top_left) * x_weight;
+    cv::Point2f bottom = bottom_left + (bottom_right - bottom_left) * x_weight;
+    return top + (bottom - top) * y_weight;
+}
+
+cv::Size angle_lookup_table::image_size() const {
+    return size;
+}
+
+// Builds the lookup table for the current frame size. Call with the mutex held.
+static void rebuild_lookup_table() {
+    if (current_frame_size.empty()) return;
+
+    camera_intrinsics intrinsics;
+
+    if (is_from_checkerboard) {
+        intrinsics = checkerboard_intrinsics;
+    } else if (current_horizontal_fov_deg > 0) {
+        double focal_length = current_frame_size.width / 2.0 / std::tan(current_horizontal_fov_deg / 2.0 / DEGREES_PER_RADIAN);
+
+        intrinsics.image_size = current_frame_size;
+        intrinsics.camera_matrix = cv::Matx33d(
+            focal_length, 0, current_frame_size.width / 2.0,
+            0, focal_length, current_frame_size.height / 2.0,
+            0, 0, 1
+        );
+        intrinsics.distortion = cv::Mat::zeros(1, 5, CV_64F);
+    } else {
+        return;
+    }
+
+    // A calibration at another resolution still holds if the aspect ratio is
+    // the same, the camera matrix scales with the image
+    if (intrinsics.image_size != current_frame_size) {
+        double x_scale = (double)current_frame_size.width / intrinsics.image_size.width;
+        double y_scale = (double)current_frame_size.height / intrinsics.image_size.height;
+        intrinsics.camera_matrix(0, 0) *= x_scale;
+        intrinsics.camera_matrix(0, 2) *= x_scale;
+        intrinsics.camera_matrix(1, 1) *= y_scale;
+        intrinsics.camera_matrix(1, 2) *= y_scale;
+        intrinsics.image_size = current_frame_size;
+    }
+
+    std::shared_ptr<const angle_lookup_table> lookup_table = std::make_shared<angle_lookup_table>(intrinsics, LOOKUP_TABLE_CELL_SIZE);
+    std::atomic_store(&current_lookup_table, lookup_table);
+
+    cv::Point2d corner_angles = lookup_table->angles_at(cv::Point2f(0, 0));
+    std::cout << "Angle lookup table built for " << current_frame_size.width << "x" << current_frame_size.height
+        << ", top left corner at " << corner_angles.x << ", " << corner_angles.y << " degrees" << std::endl;
+}
+
+void camera_model::set_frame_size(cv::Size frame_size) {
+    std::lock_guard<std::mutex> lock(camera_model_mutex);
+    if (frame_size == current_frame_size) return;
+
+    current_frame_size = frame_size;
+    rebuild_lookup_table();
+}
+
+void camera_model::use_horizontal_fov(double horizontal_fov_deg) {
+    std::lock_guard<std::mutex> lock(camera_model_mutex);
+    current_horizontal_fov_deg = horizontal_fov_deg;
+    if (is_from_checkerboard) return;
+
+    rebuild_lookup_table();
+}
+
+bool camera_model::load_intrinsics(const std::string& path) {
+    cv::FileStorage file(path, cv::FileStorage::READ);
+    if (!file.isOpened()) return false;
+
+    camera_intrinsics intrinsics;
+    cv::Mat camera_matrix;
+    file["image_width"] >> intrinsics.image_size.width;
+    file["image_height"] >> intrinsics.image_size.height;
+    file["camera_matrix"] >> camera_matrix;
+    file["distortion_coefficients"] >> intrinsics.distortion;
+
+    if (camera_matrix.size() != cv::Size(3, 3) || intrinsics.image_size.empty()) {
+        std::cerr << "Invalid camera intrinsics file " << path << std::endl;
+        return false;
+    }
+    intrinsics.camera_matrix = cv::Matx33d(camera_matrix);
+
+    std::lock_guard<std::mutex> lock(camera_model_mutex);
+    checkerboard_intrinsics = intrinsics;
+    is_from_checkerboard = true;
+    rebuild_lookup_table();
+
+    return true;
+}
+
+bool camera_model::calibrate_from_checkerboard(const std::vector<std::string>& image_paths, cv::Size pattern_size, const std::string& save_path) {
+    // Board corners in board units, the same for every view
+    std::vector<cv::Point3f> board_corners;
+    for (int row = 0; row < pattern_size.height; row++) {
+        for (int column = 0; column < pattern_size.width; column++) {
+            board_corners.emplace_back((float)column, (float)row, 0.0f);
+        }
+    }
+
+    std::vector<std::vector<cv::Point3f>> object_points;
+    std::vector<std::vector<cv::Point2f>> image_points;
+    cv::Size image_size;
+
+    for (const std::string& image_path : image_paths) {
+        cv::Mat image = cv::imread(image_path, cv::IMREAD_GRAYSCALE);
+        if (image.empty()) continue;
+
+        std::vector<cv::Point2f> corners;
+        if (!cv::findChessboardCorners(image, pattern_size, corners)) {
+            std::cout << "No checkerboard in " << image_path << std::endl;
+            continue;
+        }
+
+        cv::cornerSubPix(image, corners, cv::Size(11, 11), cv::Size(-1, -1),
+            cv::TermCriteria(cv::TermCriteria::EPS + cv::TermCriteria::COUNT, 30, 0.001));
+
+        object_points.push_back(board_corners);
+        image_points.push_back(corners);
+        image_size = image.size();
+    }
+
+    if ((int)image_points.size() < MINIMUM_CHECKERBOARD_VIEWS) {
+        std::cerr << "Checkerboard found in " << image_points.size() << " photos, need at least " << MINIMUM_CHECKERBOARD_VIEWS << std::endl;
+        return false;
+    }
+
+    cv::Mat camera_matrix;
+    cv::Mat distortion;
+    std::vector<cv::Mat> rotations;
+    std::vector<cv::Mat> translations;
+    double reprojection_error = cv::calibrateCamera(object_points, image_points, image_size, camera_matrix, distortion, rotations, translations);
+
+    std::cout << "Camera calibrated from " << image_points.size() << " photos, reprojection error " << reprojection_error << " px" << std::endl;
+
+    cv::FileStorage file(save_path, cv::FileStorage::WRITE);
+    file << "image_width" << image_size.width;
+    file << "image_height" << image_size.height;
+    file << "camera_matrix" << camera_matrix;
+    file << "distortion_coefficients" << distortion;
+
+    return true;
+}
+
+cv::Point2d camera_model::angles_at(cv::Point2f pixel, cv::Size frame_size) {
+    std::shared_ptr<const angle_lookup_table> lookup_table = std::atomic_load(&current_lookup_table);
+
+    if (lookup_table && lookup_table->image_size() == frame_size) {
+        return lookup_table->angles_at(pixel);
+    }
+
+    // Undistorted pinhole camera with the same focal length on both axes, so
+    // the vertical field of view follows from the aspect ratio
+    double half_fov_deg = parameters::webcam_fov_deg / 2.0;
+    if (half_fov_deg <= 0) return cv::Point2d(0, 0);
+
+    double focal_length = frame_size.width / 2.0 / std::tan(half_fov_deg / DEGREES_PER_RADIAN);
+    return cv::Point2d(
+        std::atan((pixel.x - frame_size.width / 2.0) / focal_length) * DEGREES_PER_RADIAN,
+        std::atan((pixel.y - frame_size.height / 2.0) / focal_length) * DEGREES_PER_RADIAN
+    );
+}
@@ -1,21 +1,53 @@
 #include "cv_actions.hpp"
 
+// Setting the input size rebuilds the detector's anchor boxes, so skip it
+// when the search area has not changed size
+static void set_input_size(cv::Ptr<cv::FaceDetectorYN>& face_model, cv::Size size) {
+    if (face_model->getInputSize() != size) {
+        face_model->setInputSize(size);
+    }
+}
+
+int cv_actions::stable_search_side(int needed_side, int previous_side, int frame_side) {
+    int side = (needed_side + SEARCH_AREA_STEP - 1) / SEARCH_AREA_STEP * SEARCH_AREA_STEP;
+    if (side + SEARCH_AREA_STEP == previous_side) side = previous_side;
+    return std::min(side, frame_side);
+}
+
+void cv_actions::draw_face_markers(cv::Mat& frame, const face_markers& markers) {
+    if (!markers.has_face) return;
+
+    // Draw search bounds
+    cv::rectangle(frame, markers.search_bounds, cv::Scalar(255, 0, 0), 2);
+
+    // Draw face rectangle
+    cv::rectangle(frame, markers.face_rect, cv::Scalar(0, 255, 0), 2);
+
+    // Draw eye positions
+    cv::circle(frame, markers.left_eye_position, 5, cv::Scalar(255, 0, 0), -1);
+    cv::circle(frame, markers.right_eye_position, 5, cv::Scalar(255, 0, 0), -1);
+}
+
 bool cv_actions::detect_face(
     cv::Ptr<cv::FaceDetectorYN>& face_model, 
     cv::Rect& search_bounds,
-    cv::VideoCapture &cap,
     cv::Mat& out_frame, 
-    std::tuple<double, double>& left_eye_position_proportion_from_center,
-    std::tuple<double, double>& right_eye_position_proportion_from_center
+    cv::Point2f& left_eye_position,
+    cv::Point2f& right_eye_position,
+    float detector_scale,
+    float search_area_size,
+    face_detection_buffers& buffers,
+    face_detection_stats& stats,
+    face_markers& markers
 ) {
-    
-    if (!cap.isOpened()) {
-        return false; // Failed to open webcam
-    }
+    std::chrono::steady_clock::time_point detect_start = std::chrono::steady_clock::now();
+    stats.search_bounds = search_bounds;
+    stats.confidence = 0;
+    stats.detect_ms = 0;
+    markers.has_face = false;
 
-    cap >> out_frame; // Capture a full_frame
     if (out_frame.empty()) {
-        return false; // Failed to capture full_frame
+        return false; // Webcam did not give a frame
     }
 
     if (search_bounds.width < 63 || search_bounds.height < 63) {
@@ -31,12 +63,38 @@ bool cv_actions::detect_face(
     }
 
 
-    face_model->setInputSize(search_bounds.size());
-
     cv::Mat sub_mat = cv::Mat(out_frame, search_bounds);
-    cv::Mat output_array;
-
-    face_model->detect(sub_mat, output_array);
+    cv::Mat& output_array = buffers.detections;
+
+    // Never shrink below the detector's minimum size
+    float scale = std::max(detector_scale, 64.0f / std::min(search_bounds.width, search_bounds.height));
+
+    if (scale < 1.0f) {
+        // Allocated once at full frame size. The search area is shrunk into a
+        // view of it, so a new search area size does not reallocate.
+        if (buffers.scaled_search_area.size() != out_frame.size() || buffers.scaled_search_area.type() != out_frame.type()) {
+            buffers.scaled_search_area.create(out_frame.size(), out_frame.type());
+        }
+        cv::Size scaled_size(
+            std::max(1, (int)std::lround(search_bounds.width * scale)),
+            std::max(1, (int)std::lround(search_bounds.height * scale))
+        );
+        cv::Mat scaled_mat = buffers.scaled_search_area(cv::Rect(cv::Point(0, 0), scaled_size));
+        cv::resize(sub_mat, scaled_mat, scaled_size, 0, 0, cv::INTER_AREA);
+
+        set_input_size(face_model, scaled_mat.size());
+        face_model->detect(scaled_mat, output_array);
+
+        // Back to search area coordinates. The last column is the confidence.
+        if (output_array.rows > 0) {
+            cv::Mat coordinates = output_array.colRange(0, 14);
+            coordinates /= scale;
+        }
+    } else {
+        set_input_size(face_model, search_bounds.size());
+        face_model->detect(sub_mat, output_array);
+    }
+    stats.detect_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - detect_start).count();
 
     if (output_array.rows == 0) {
         search_bounds = cv::Rect(
@@ -48,54 +106,36 @@ bool cv_actions::detect_face(
         return false; // No face detected
     }
 
+    stats.confidence = output_array.at<float>(0, 14);
+
     int face_x = (int)output_array.at<float>(0, 0) + search_bounds.x;
     int face_y = (int)output_array.at<float>(0, 1) + search_bounds.y;
     int face_width = (int)output_array.at<float>(0, 2);
     int face_height = (int)output_array.at<float>(0, 3);
     cv::Rect face_rect(face_x, face_y, face_width, face_height);
 
-    left_eye_position_proportion_from_center = std::make_tuple(
-        (double)(output_array.at<float>(0, 6) + search_bounds.x - out_frame.cols/2) / out_frame.cols * 2,
-        (double)(output_array.at<float>(0, 7) + search_bounds.y - out_frame.rows/2) / out_frame.rows * 2
-    );
-
-    right_eye_position_proportion_from_center = std::make_tuple(
-        (double)(output_array.at<float>(0, 4) + search_bounds.x - out_frame.cols/2) / out_frame.cols * 2,
-        (double)(output_array.at<float>(0, 5) + search_bounds.y - out_frame.rows/2) / out_frame.rows * 2
+    left_eye_position = cv::Point2f(
+        output_array.at<float>(0, 6) + search_bounds.x,
+        output_array.at<float>(0, 7) + search_bounds.y
     );
-
-    cv::Point left_eye_position;
-    cv::Point right_eye_position;
-
-    left_eye_position = cv::Point(
-        (int)output_array.at<float>(0, 6) + search_bounds.x,
-        (int)output_array.at<float>(0, 7) + search_bounds.y
+    right_eye_position = cv::Point2f(
+        output_array.at<float>(0, 4) + search_bounds.x,
+        output_array.at<float>(0, 5) + search_bounds.y
     );
-    right_eye_position = cv::Point(
-        (int)output_array.at<float>(0, 4) + search_bounds.x,
-        (int)output_array.at<float>(0, 5) + search_bounds.y
-    );
-
-
-    // Draw search bounds
-    cv::rectangle(out_frame, search_bounds, cv::Scalar(255, 0, 0), 2);
-
-    // Draw face rectangle
-    cv::rectangle(out_frame, cv::Rect(
-        face_x,
-        face_y,
-        face_width,
-        face_height
-    ), cv::Scalar(0, 255, 0), 2);
-
-    // Draw eye positions
-    cv::circle(out_frame, left_eye_position, 5, cv::Scalar(255, 0, 0), -1);
-    cv::circle(out_frame, right_eye_position, 5, cv::Scalar(255, 0, 0), -1);
 
-    int x_new = std::clamp((int)(face_x + face_width/2 - face_width*SEARCH_AREA_SIZE/2), 0, out_frame.cols);
-    int y_new = std::clamp((int)(face_y + face_height/2 - face_height*SEARCH_AREA_SIZE/2), 0, out_frame.rows);
-    int width_new = std::clamp((int)(face_width*SEARCH_AREA_SIZE), 0, out_frame.cols - x_new);
-    int height_new = std::clamp((int)(face_height*SEARCH_AREA_SIZE), 0, out_frame.rows - y_new);
+    markers.has_face = true;
+    markers.search_bounds = search_bounds;
+    markers.face_rect = face_rect;
+    markers.left_eye_position = left_eye_position;
+    markers.right_eye_position = right_eye_position;
+    draw_face_markers(out_frame, markers);
+
+    // Sized in steps and shifted rather than cropped at the frame edge, so the
+    // detector input keeps its size from frame to frame
+    int width_new = stable_search_side((int)std::ceil(face_width*search_area_size), search_bounds.width, out_frame.cols);
+    int height_new = stable_search_side((int)std::ceil(face_height*search_area_size), search_bounds.height, out_frame.rows);
+    int x_new = std::clamp(face_x + face_width/2 - width_new/2, 0, out_frame.cols - width_new);
+    int y_new = std::clamp(face_y + face_height/2 - height_new/2, 0, out_frame.rows - height_new);
 
     search_bounds = cv::Rect(
         x_new,
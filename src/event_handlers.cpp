@@ -1,4 +1,6 @@
 #include "event_handlers.hpp"
+#include "object_cache.hpp"
+#include "camera_model.hpp"
 
 // Parameters used to calculate other final parameters
 // These do not need to be saved
@@ -57,18 +59,19 @@ void event_handlers::on_measurements_continue_clicked(GtkWidget *widget, gpointe
 
     if (!was_parse_successful) return;
 
-    float qr_code_angular_size = std::atan2(QR_CODE_WIDTH/2, working_parameters::qr_code_distance) * 2 *(180.0/3.141592653589793238463);
-    parameters::webcam_fov_deg = qr_code_angular_size * working_parameters::qr_code_inverse_proportion;
+    // Pinhole camera. The QR code's half width over its distance is the
+    // tangent of its half angle, and the frame is qr_code_inverse_proportion
+    // QR codes wide, so scale the tangent rather than the angle.
+    parameters::webcam_fov_deg = std::atan(QR_CODE_WIDTH / 2 / working_parameters::qr_code_distance * working_parameters::qr_code_inverse_proportion) * 2 * (180.0/3.141592653589793238463);
+    camera_model::use_horizontal_fov(parameters::webcam_fov_deg);
 
     std::cout << "QR Code distance: " << working_parameters::qr_code_distance << " in." << std::endl;
-    std::cout << "Webcam FOV: " << qr_code_angular_size << " degrees" << std::endl; 
+    std::cout << "Webcam FOV: " << parameters::webcam_fov_deg << " degrees" << std::endl;
     std::cout << "Lenticule density: " << working_parameters::lenticule_density << " LPI" << std::endl;
     std::cout << "Index of refraction: " << parameters::index_of_refraction << std::endl;
 
     // Tell 3D renderer to display the measurement window
-    std::vector<int64_t> message;
-    message.push_back((int64_t)0);
-    boost::asio::write(shared_vars::renderer_socket, boost::asio::buffer(message));
+    renderer_server::send(renderer_server::make_message(0));
 
     // Switch to display density
     gtk_stack_set_visible_child_name(shared_vars::stack_widget, "display_density_calibration_box");
@@ -92,17 +95,13 @@ void event_handlers::on_display_density_continue_clicked(GtkWidget *widget, gpoi
     std::cout << "Distance from green to the red line: " << working_parameters::green_to_red_line_distance << " in." << std::endl;
 
     // Tell 3D renderer to hide the measurement window
-    std::vector<int64_t> message;
-    message.push_back((int64_t)1);
-    boost::asio::write(shared_vars::renderer_socket, boost::asio::buffer(message));
+    renderer_server::send(renderer_server::make_message(1));
 
     // Find pixels per lens, and send it to the 3D renderer
     // Also send the index of refraction
     parameters::pixels_per_lens = 500.0 / working_parameters::green_to_red_line_distance / working_parameters::lenticule_density;
     std::cout << "Event handlers.cpp. Line 84. pixels_per_lens is " << parameters::pixels_per_lens << std::endl;
-    boost::asio::write(shared_vars::renderer_socket, boost::asio::buffer({(int64_t)2}));
-    boost::asio::write(shared_vars::renderer_socket, boost::asio::buffer({(float_t)parameters::pixels_per_lens}));
-    boost::asio::write(shared_vars::renderer_socket, boost::asio::buffer({(float_t)parameters::index_of_refraction}));
+    shared_vars::send_settings_to_renderer();
 
     // Write all parameters to a save file
     std::ofstream save_file("calibration_settings.txt");
@@ -123,9 +122,8 @@ void on_new_object_selected(GObject* source_object, GAsyncResult* res, gpointer
     g_object_unref(G_OBJECT(file_dialog_pointer));
     g_object_unref(G_OBJECT(file));
 
-    // Send the file to the renderer through socket
-    boost::asio::write(shared_vars::renderer_socket, boost::asio::buffer({(int64_t)6, (int64_t)file_pathname.length()}));
-    boost::asio::write(shared_vars::renderer_socket, boost::asio::buffer(file_pathname));
+    // Convert the model if needed, then send it to the renderers
+    object_cache::display(file_pathname);
 }
 
 void event_handlers::on_change_object_clicked(GtkWidget *widget, gpointer data) 
@@ -0,0 +1,56 @@
+#include "frame_pool.hpp"
+
+frame_pool::frame_pool(size_t expected_buffers) {
+    buffers.reserve(expected_buffers);
+    free_buffers.reserve(expected_buffers);
+}
+
+GdkPaintable* frame_pool::to_paintable(const cv::Mat& bgr_frame) {
+    buffer* frame;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        if (free_buffers.empty()) {
+            buffers.push_back(std::make_unique<buffer>());
+            buffers.back()->pool = this;
+            free_buffers.reserve(buffers.size());
+            frame = buffers.back().get();
+        } else {
+            frame = free_buffers.back();
+            free_buffers.pop_back();
+        }
+    }
+
+    // GTK reads BGR as is, so this is a plain copy. Reuses the buffer unless
+    // the frame size changed. cvtColor is avoided, it allocates for its
+    // worker threads on every call.
+    bgr_frame.copyTo(frame->bgr);
+
+    // The texture reads straight from the pooled buffer
+    GBytes* bytes = g_bytes_new_with_free_func(frame->bgr.data, frame->bgr.total() * frame->bgr.elemSize(), frame_pool::release, frame);
+
+    GdkTexture* texture = gdk_memory_texture_new(
+        frame->bgr.cols,           // width
+        frame->bgr.rows,           // height
+        GDK_MEMORY_B8G8R8,         // format (BGR, 8 bits per channel)
+        bytes,                     // data
+        frame->bgr.step[0]         // stride
+    );
+
+    g_bytes_unref(bytes);
+
+    return GDK_PAINTABLE(texture);
+}
+
+size_t frame_pool::size() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return buffers.size();
+}
+
+void frame_pool::release(gpointer data) {
+    buffer* frame = static_cast<buffer*>(data);
+
+    std::lock_guard<std::mutex> lock(frame->pool->mutex);
+    frame->pool->free_buffers.push_back(frame);
+}
@@ -1,7 +1,7 @@
 #include <iostream>
 #include <thread>
 #include <chrono>
-#include <mutex>
+#include <algorithm>
 
 #include <boost/asio.hpp>
 
@@ -9,164 +9,235 @@
 #include <glibmm.h>
 
 #include <opencv2/core/mat.hpp>
+#include <opencv2/core/utility.hpp>
 
 #include "shared.hpp"
 #include "gtk_signal_data.hpp"
 #include "cv_actions.hpp"
 #include "event_handlers.hpp"
+#include "startup.hpp"
+#include "pose_recorder.hpp"
+#include "renderer_server.hpp"
+#include "object_cache.hpp"
+#include "quality_governor.hpp"
+#include "camera_model.hpp"
+#include "frame_pool.hpp"
+#include "allocation_counter.hpp"
+#include "motion_gate.hpp"
 
-GdkPaintable* cv_mat_to_paintable(const cv::Mat& mat) {
-    cv::Mat rgb_mat;
-
-    // Convert BGR to RGB (OpenCV uses BGR, GTK expects RGB)
-    cv::cvtColor(mat, rgb_mat, cv::COLOR_BGR2RGB);
-    
-    // Create GBytes from cv::Mat data
-    GBytes* bytes = g_bytes_new(rgb_mat.data, rgb_mat.total() * rgb_mat.elemSize());
-    
-    // Create GdkTexture from bytes
-    GdkTexture* texture = gdk_memory_texture_new(
-        rgb_mat.cols,              // width
-        rgb_mat.rows,              // height
-        GDK_MEMORY_R8G8B8,         // format (RGB, 8 bits per channel)
-        bytes,                     // data
-        rgb_mat.step[0]            // stride
-    );
-
-    GdkPaintable *paintable = GDK_PAINTABLE(texture);
-
-    g_bytes_unref(bytes);
-
-    return paintable;
-}
+// Three snapshot slots, plus the frame the GtkPictures are showing
+const size_t PREVIEW_FRAME_POOL_SIZE = 4;
+
+// Frames between allocation reports, when built with COUNT_FRAME_ALLOCATIONS
+const int ALLOCATION_REPORT_INTERVAL = 600;
+
+// Outlives every texture it hands out, GTK is gone before statics are destroyed
+static frame_pool preview_frames(PREVIEW_FRAME_POOL_SIZE);
 
 void request_cv_process_update() {
-    while (shared_vars::do_cv_thread_run) {
+    int frame_index = 0;
+
+    // Reused every frame, so the loop stops allocating once sizes settle
+    cv::Mat output;
+
+    // Frame size the eye angle lookup table was last built for
+    cv::Size camera_model_frame_size;
+    cv_actions::face_detection_buffers detection_buffers;
+
+    // Redrawn on frames the detector skips, so the preview does not flicker
+    cv_actions::face_markers last_face_markers;
 
-        // Lock the mutex
-        shared_vars::webcam_paintable_mutex.lock();
+    uint64_t allocations_since_report = 0;
+    uint64_t most_allocations_in_a_frame = 0;
 
-        cv::Mat output;
+    while (shared_vars::do_cv_thread_run) {
+        uint64_t allocations_at_frame_start = allocation_counter::thread_count();
+
+        quality_decision quality = quality_governor::current();
+        std::chrono::steady_clock::time_point frame_start = std::chrono::steady_clock::now();
+        double capture_ms = 0;
+
+        bool is_tracking_face = shared_vars::is_current_cv_action_face;
+        bool has_run_detector = false;
+
+        if (is_tracking_face) {
+            // Read the webcam every frame, even when detection is skipped, so
+            // frames do not queue up and the preview keeps moving.
+            shared_vars::webcam_capture >> output;
+            capture_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - frame_start).count();
+
+            // The startup grab may have failed, or the webcam switched resolution.
+            // The search area is in the old frame's coordinates, so search the
+            // whole new frame.
+            if (!output.empty() && output.size() != camera_model_frame_size) {
+                camera_model::set_frame_size(output.size());
+                camera_model_frame_size = output.size();
+                shared_vars::bounding_box = cv::Rect(0, 0, output.cols, output.rows);
+                motion_gate::reset();
+                last_face_markers.has_face = false;
+            }
+        }
 
-        if (!shared_vars::is_current_cv_action_face) { 
-            // Do QR Code
-            cv_actions::detect_qr(shared_vars::webcam_capture, output, working_parameters::qr_code_inverse_proportion);
+        if (!is_tracking_face) { 
+            // Do QR Code. The face found before is stale once tracking resumes.
+            last_face_markers.has_face = false;
+            float qr_code_inverse_proportion;
+            if (cv_actions::detect_qr(shared_vars::webcam_capture, output, qr_code_inverse_proportion)) {
+                working_parameters::qr_code_inverse_proportion = qr_code_inverse_proportion;
+            }
+        } else if (output.empty()) {
+            // Webcam did not give a frame
+        } else if (frame_index % quality.detection_interval != 0) {
+            // Detection skipped this frame by the quality governor
+            cv_actions::draw_face_markers(output, last_face_markers);
+        } else if (motion_gate::is_static(output, shared_vars::bounding_box)) {
+            // Nothing moved since the detector last ran, so the renderer
+            // already has this pose
+            cv_actions::draw_face_markers(output, last_face_markers);
         } else {
             // Run action
-            std::tuple<double, double> left_eye_position_proportion_from_center;
-            std::tuple<double, double> right_eye_position_proportion_from_center;
-            bool result = cv_actions::detect_face(shared_vars::face_detector_pointer, shared_vars::bounding_box, shared_vars::webcam_capture, output, left_eye_position_proportion_from_center, right_eye_position_proportion_from_center);
+            has_run_detector = true;
+            cv::Point2f left_eye_position;
+            cv::Point2f right_eye_position;
+            cv_actions::face_detection_stats stats;
+            bool result = cv_actions::detect_face(shared_vars::face_detector_pointer, shared_vars::bounding_box, output, left_eye_position, right_eye_position, quality.detector_scale, quality.search_area_size, detection_buffers, stats, last_face_markers);
+            stats.capture_ms = capture_ms;
+
+            pose_record record = {};
             
             if (result) {
-                double left_eye_horizontal_angle = std::get<0>(left_eye_position_proportion_from_center) * (parameters::webcam_fov_deg / 2.0f);
-                double left_eye_vertical_angle = std::get<1>(left_eye_position_proportion_from_center) * (parameters::webcam_fov_deg / 2.0f);
-                double right_eye_horizontal_angle = std::get<0>(right_eye_position_proportion_from_center) * (parameters::webcam_fov_deg / 2.0f);
-                double right_eye_vertical_angle = std::get<1>(right_eye_position_proportion_from_center) * (parameters::webcam_fov_deg / 2.0f);
-
-                shared_vars::left_eye_horizontal_angle_buffer_sum += left_eye_horizontal_angle;
-                shared_vars::left_eye_horizontal_angle_buffer.push(left_eye_horizontal_angle);
-                shared_vars::left_eye_vertical_angle_buffer_sum += left_eye_vertical_angle;
-                shared_vars::left_eye_vertical_angle_buffer.push(left_eye_vertical_angle);
-                shared_vars::right_eye_horizontal_angle_buffer_sum += right_eye_horizontal_angle;
-                shared_vars::right_eye_horizontal_angle_buffer.push(right_eye_horizontal_angle);
-                shared_vars::right_eye_vertical_angle_buffer_sum += right_eye_vertical_angle;
-                shared_vars::right_eye_vertical_angle_buffer.push(right_eye_vertical_angle);
-
-                if (shared_vars::left_eye_horizontal_angle_buffer.size() > shared_vars::BUFFER_SIZE) {
-                    shared_vars::left_eye_horizontal_angle_buffer_sum -= shared_vars::left_eye_horizontal_angle_buffer.front();
-                    shared_vars::left_eye_horizontal_angle_buffer.pop();
-                }
+                startup::mark_once("first tracked pose");
 
-                if (shared_vars::left_eye_vertical_angle_buffer.size() > shared_vars::BUFFER_SIZE) {
-                    shared_vars::left_eye_vertical_angle_buffer_sum -= shared_vars::left_eye_vertical_angle_buffer.front();
-                    shared_vars::left_eye_vertical_angle_buffer.pop();
-                }
+                // Table lookup, distortion is already accounted for
+                cv::Point2d left_eye_angles = camera_model::angles_at(left_eye_position, output.size());
+                cv::Point2d right_eye_angles = camera_model::angles_at(right_eye_position, output.size());
 
-                if (shared_vars::right_eye_horizontal_angle_buffer.size() > shared_vars::BUFFER_SIZE) {
-                    shared_vars::right_eye_horizontal_angle_buffer_sum -= shared_vars::right_eye_horizontal_angle_buffer.front();
-                    shared_vars::right_eye_horizontal_angle_buffer.pop();
-                }
+                // Left horizontal, left vertical, right horizontal, right vertical
+                double raw_eye_angles[4] = {left_eye_angles.x, left_eye_angles.y, right_eye_angles.x, right_eye_angles.y};
+                double filtered_eye_angles[4];
+                shared_vars::filter_eye_angles(raw_eye_angles, filtered_eye_angles);
 
-                if (shared_vars::right_eye_vertical_angle_buffer.size() > shared_vars::BUFFER_SIZE) {
-                    shared_vars::right_eye_vertical_angle_buffer_sum -= shared_vars::right_eye_vertical_angle_buffer.front();
-                    shared_vars::right_eye_vertical_angle_buffer.pop();
+                if (shared_vars::is_renderer_active) {
+                    renderer_server::send_eye_angles(filtered_eye_angles);
                 }
 
+                record.flags |= POSE_RECORD_HAS_POSE;
+                std::copy(raw_eye_angles, raw_eye_angles + 4, record.raw_eye_angles);
+                std::copy(filtered_eye_angles, filtered_eye_angles + 4, record.filtered_eye_angles);
+            }
 
+            record.search_bounds[0] = stats.search_bounds.x;
+            record.search_bounds[1] = stats.search_bounds.y;
+            record.search_bounds[2] = stats.search_bounds.width;
+            record.search_bounds[3] = stats.search_bounds.height;
+            record.confidence = stats.confidence;
+            record.capture_ms = stats.capture_ms;
+            record.detect_ms = stats.detect_ms;
+            record.quality_level = quality.level;
+            record.total_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - frame_start).count();
+            pose_recorder::record(record);
+        }
 
-                if (shared_vars::is_renderer_active) {
-                    std::vector<int64_t> request_code;
-                    request_code.push_back((int64_t)4);
-                    
-                    try {
-                        boost::asio::write(shared_vars::renderer_socket, boost::asio::buffer(request_code));
-                    } catch (const boost::system::system_error& e) {
-                        if (e.code() == boost::asio::error::broken_pipe || 
-                            e.code() == boost::asio::error::connection_reset ||
-                            e.code() == boost::asio::error::eof) {
-                            std::cout << "Socket disconnected: " << e.what() << std::endl;
-                            shared_vars::is_renderer_active = false;
-
-                            g_application_quit(G_APPLICATION(shared_vars::app));
-                        }
-                    }
-
-                    double avg_left_eye_horizontal_angle = shared_vars::left_eye_horizontal_angle_buffer_sum / shared_vars::left_eye_horizontal_angle_buffer.size();
-                    double avg_left_eye_vertical_angle = shared_vars::left_eye_vertical_angle_buffer_sum / shared_vars::left_eye_vertical_angle_buffer.size();
-                    double avg_right_eye_horizontal_angle = shared_vars::right_eye_horizontal_angle_buffer_sum / shared_vars::right_eye_horizontal_angle_buffer.size();
-                    double avg_right_eye_vertical_angle = shared_vars::right_eye_vertical_angle_buffer_sum / shared_vars::right_eye_vertical_angle_buffer.size();
-                    
-
-                    std::vector<double_t> message;
-                    message.push_back(avg_left_eye_horizontal_angle);
-                    message.push_back(avg_left_eye_vertical_angle);
-                    message.push_back(avg_right_eye_horizontal_angle);
-                    message.push_back(avg_right_eye_vertical_angle);
-
-                    try {
-                        boost::asio::write(shared_vars::renderer_socket, boost::asio::buffer(message));
-                    } catch (const boost::system::system_error& e) {
-                        if (e.code() == boost::asio::error::broken_pipe || 
-                            e.code() == boost::asio::error::connection_reset ||
-                            e.code() == boost::asio::error::eof) {
-                            std::cout << "Socket disconnected: " << e.what() << std::endl;
-                            shared_vars::is_renderer_active = false;
-
-                            g_application_quit(G_APPLICATION(shared_vars::app));
-                        }
-                    }
-                }
+        if (frame_index % quality.preview_interval == 0 && !output.empty()) {
+            // Convert to GdkPaintable. The back slot is never seen by the GTK
+            // thread, and the GtkPictures hold their own reference to anything
+            // they were shown, so the old paintable can be dropped here.
+            tracking_snapshot& snapshot = shared_vars::tracking_snapshots.back();
+            if (snapshot.paintable) {
+                g_object_unref(snapshot.paintable);
             }
-        }
+            snapshot.paintable = preview_frames.to_paintable(output);
 
-        // Convert to GdkPaintable
-        GdkPaintable* new_paintable = cv_mat_to_paintable(output);
+            // Hand the frame to the GTK thread without waiting on it
+            shared_vars::tracking_snapshots.publish();
 
-        
-        if (shared_vars::webcam_paintable) {
-        g_object_unref(shared_vars::webcam_paintable);
+            // Notify the main thread to update the UI
+            shared_vars::webcam_dispatcher.emit();
         }
 
-        // Update the shared paintable
-        shared_vars::webcam_paintable = new_paintable;
-
-        // Unlock mutex
-        shared_vars::webcam_paintable_mutex.unlock();
+        // Only frames the detector ran on measure what a quality level costs.
+        // Skipped frames would drag the average down and the level would
+        // bounce between too slow and apparently fast enough. Waiting on the
+        // webcam is not load either, leave it out.
+        if (has_run_detector) {
+            double processing_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - frame_start).count() - capture_ms;
+            quality_governor::report_frame_time(processing_ms);
+        }
 
-        // Notify the main thread to update the UI
-        shared_vars::webcam_dispatcher.emit();
+        if (allocation_counter::is_enabled()) {
+            uint64_t frame_allocations = allocation_counter::thread_count() - allocations_at_frame_start;
+            allocations_since_report += frame_allocations;
+            most_allocations_in_a_frame = std::max(most_allocations_in_a_frame, frame_allocations);
+
+            if ((frame_index + 1) % ALLOCATION_REPORT_INTERVAL == 0) {
+                std::cout << "Allocations per frame over the last " << ALLOCATION_REPORT_INTERVAL << " frames: mean "
+                    << (double)allocations_since_report / ALLOCATION_REPORT_INTERVAL << ", max " << most_allocations_in_a_frame
+                    << ". Preview buffers: " << preview_frames.size() << std::endl;
+                allocations_since_report = 0;
+                most_allocations_in_a_frame = 0;
+            }
+        }
 
+        frame_index++;
         std::this_thread::sleep_for(std::chrono::milliseconds(1000/60));
     }
 }
 
 void handle_webcam_dispatch() {  
-    shared_vars::webcam_paintable_mutex.lock();
+    // Several dispatches may be queued up behind one newer frame
+    if (!shared_vars::tracking_snapshots.acquire()) {
+        return;
+    }
+
+    GdkPaintable* paintable = shared_vars::tracking_snapshots.front().paintable;
+
+    gtk_picture_set_paintable(shared_vars::main_webcam_image, paintable);
+    gtk_picture_set_paintable(shared_vars::fov_webcam_image, paintable);
+}
 
-    gtk_picture_set_paintable(shared_vars::main_webcam_image, shared_vars::webcam_paintable);
-    gtk_picture_set_paintable(shared_vars::fov_webcam_image, shared_vars::webcam_paintable);
+// Command line options, parsed in main before GTK sees them
+static std::string replay_log_path;
+static bool is_replay_refiltered = false; // Replay raw poses through the filter
+static std::string record_log_path; // Empty unless recording was asked for
+static std::string checkerboard_directory;
+static cv::Size checkerboard_pattern_size(9, 6);
+
+// Removes the options handled here from argv. GApplication rejects anything
+// it does not know about.
+static void parse_command_line(int& argc, char** argv) {
+    int kept_argc = 1;
+
+    for (int i = 1; i < argc; i++) {
+        std::string argument(argv[i]);
+
+        if (argument == "--replay" && i + 1 < argc) {
+            replay_log_path = argv[++i];
+            is_replay_refiltered = false;
+        } else if (argument == "--replay-raw" && i + 1 < argc) {
+            replay_log_path = argv[++i];
+            is_replay_refiltered = true;
+        } else if (argument == "--record" && i + 1 < argc) {
+            record_log_path = argv[++i];
+        } else if (argument == "--record-session") {
+            record_log_path = pose_recorder::default_log_path();
+        } else if (argument == "--latency-budget-ms" && i + 1 < argc) {
+            quality_governor::set_latency_budget_ms(std::stod(argv[++i]));
+        } else if (argument == "--calibrate-checkerboard" && i + 1 < argc) {
+            checkerboard_directory = argv[++i];
+        } else if (argument == "--checkerboard-corners" && i + 2 < argc) {
+            checkerboard_pattern_size = cv::Size(std::stoi(argv[i + 1]), std::stoi(argv[i + 2]));
+            i += 2;
+        } else if (argument == "--object-cache") {
+            object_cache::set_renderer_cache_enabled(true);
+        } else if (argument == "--no-motion-gate") {
+            motion_gate::set_enabled(false);
+        } else {
+            argv[kept_argc++] = argv[i];
+        }
+    }
 
-    shared_vars::webcam_paintable_mutex.unlock();
+    argc = kept_argc;
+    argv[argc] = nullptr;
 }
 
 // Signal handler for the button click
@@ -184,6 +255,14 @@ activate (GtkApplication *app,
     GtkCssProvider *css_provider;
     GError *error = NULL;
 
+    startup::begin();
+
+    // Webcam, face detector and calibration file load on worker threads while
+    // the UI is built here. The renderer is spawned first since it is the
+    // slowest to come up.
+    startup::launch_background_tasks();
+    startup::start_renderer();
+
     // Create a builder and load the UI file
     shared_vars::builder = gtk_builder_new ();
     if (!gtk_builder_add_from_file (shared_vars::builder, "ui/main.ui", &error)) {
@@ -201,30 +280,29 @@ activate (GtkApplication *app,
     shared_vars::main_webcam_image = GTK_PICTURE(gtk_builder_get_object (shared_vars::builder, "main_webcam_image"));
     shared_vars::fov_webcam_image = GTK_PICTURE(gtk_builder_get_object (shared_vars::builder, "fov_webcam_image"));
 
-    // Set up video capture
-    shared_vars::webcam_capture.open(0);
-    if (!shared_vars::webcam_capture.isOpened()) {
-        std::cerr << "Error: Could not open webcam." << std::endl;
-    }
-
-    // Get a frame and set up bounding box
-    cv::Mat first_frame;
-    shared_vars::webcam_capture >> first_frame;
-    if (first_frame.empty()) {
-        std::cerr << "Error: Could not capture initial frame from webcam." << std::endl;
-    } else {
-        shared_vars::bounding_box = cv::Rect(0, 0, first_frame.cols, first_frame.rows);
-    }
-
-    // Set up face detector
-    shared_vars::face_detector_pointer = cv::FaceDetectorYN::create("models/face_detector_model.onnx", "", cv::Size(1, 1), 0.9, 0.3, 1);
-
     // Connect the dispatcher signal to the handler
     shared_vars::webcam_dispatcher.connect([]() {
         handle_webcam_dispatch();
     });
 
-    shared_vars::cv_process_thread = std::thread(request_cv_process_update);
+    if (!replay_log_path.empty()) {
+        // Feed recorded poses to the renderer instead of tracking
+        shared_vars::cv_process_thread = std::thread(pose_recorder::replay, replay_log_path, is_replay_refiltered);
+    } else {
+        if (!record_log_path.empty()) {
+            pose_recorder::start(record_log_path);
+        }
+
+        // The CV thread waits for the webcam and face detector before looping
+        shared_vars::cv_process_thread = std::thread([]() {
+            if (!startup::wait_for_cv_dependencies()) {
+                std::cerr << "Error: Face detector unavailable, CV thread not started." << std::endl;
+                return;
+            }
+
+            request_cv_process_update();
+        });
+    }
 
     // Get the CSS provider
     css_provider = gtk_css_provider_new();
@@ -262,18 +340,7 @@ activate (GtkApplication *app,
     // Show the window
 
     gtk_window_present (GTK_WINDOW (shared_vars::main_window));
-
-    // Start the renderer
-    shared_vars::acceptor.open(shared_vars::endpoint.protocol());
-    shared_vars::acceptor.set_option(boost::asio::ip::tcp::acceptor::reuse_address(true));
-    shared_vars::acceptor.bind(shared_vars::endpoint);
-    shared_vars::acceptor.listen(1);
-
-    std::thread t(shared_vars::listen_for_renderer_socket_and_call_dispatcher);
-    t.detach();
-
-    shared_vars::renderer_program = new boost::process::child("renderer");
-
+    startup::mark("window presented");
 }
 
 static void deactivate(GtkApplication *app, void *data) {
@@ -281,19 +348,25 @@ static void deactivate(GtkApplication *app, void *data) {
     shared_vars::do_cv_thread_run = false;
 
     std::cout << "Joining thread, waiting for thread end" << std::endl;
-    shared_vars::cv_process_thread.join();
+    if (shared_vars::cv_process_thread.joinable()) {
+        shared_vars::cv_process_thread.join();
+    }
     std::cout << "Thread ended" << std::endl;
 
+    pose_recorder::stop();
+    object_cache::stop();
+
     std::cout << "Releasing webcam" << std::endl;
     shared_vars::webcam_capture.release();
 
-    std::cout << "Tell renderer to quit" << std::endl;
+    std::cout << "Tell renderers to quit" << std::endl;
 
-    if (shared_vars::is_renderer_active && shared_vars::renderer_socket.is_open()) {
-        boost::asio::write(shared_vars::renderer_socket, boost::asio::buffer({(int64_t)5}));
+    if (shared_vars::is_renderer_active) {
+        std::cout << renderer_server::client_count() << " renderer(s) connected" << std::endl;
     } else {
         std::cout << "Renderer already inactive, skipping quit message." << std::endl;
     }
+    renderer_server::shutdown();
 }
 
 int
@@ -305,6 +378,17 @@ main (int    argc,
 
     int status;
 
+    allocation_counter::install();
+    parse_command_line(argc, argv);
+
+    // Calibrating from checkerboard photos is a one off, no UI needed
+    if (!checkerboard_directory.empty()) {
+        std::vector<cv::String> image_paths;
+        cv::glob(checkerboard_directory + "/*", image_paths);
+        std::vector<std::string> paths(image_paths.begin(), image_paths.end());
+        return camera_model::calibrate_from_checkerboard(paths, checkerboard_pattern_size, CAMERA_INTRINSICS_FILE) ? 0 : 1;
+    }
+
     shared_vars::app = gtk_application_new ("org.gtk.example", G_APPLICATION_DEFAULT_FLAGS);
     g_signal_connect (shared_vars::app, "activate", G_CALLBACK (activate), NULL);
     g_signal_connect (shared_vars::app, "shutdown", G_CALLBACK (deactivate), NULL);
@@ -0,0 +1,203 @@
+/*
+Mock renderer. Connects to the controller like the Godot renderer does, reads
+every message, and reports how fast eye angles arrive and how evenly spaced
+they are. Can also act as a slow or disconnecting renderer to check that
+other renderers are not affected.
+
+Usage: mock_renderer [--clients N] [--slow-clients N] [--slow-ms MS]
+                     [--disconnect-clients N] [--disconnect-after S]
+                     [--duration S] [--host HOST] [--port PORT]
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/asio.hpp>
+
+using boost::asio::ip::tcp;
+
+struct mock_options {
+    std::string host = "127.0.0.1";
+    unsigned short port = 42842;
+    int clients = 1;
+    int slow_clients = 0;
+    int slow_ms = 100;
+    int disconnect_clients = 0;
+    double disconnect_after_s = 5;
+    double duration_s = 10;
+};
+
+struct client_report {
+    std::map<int64_t, uint64_t> message_counts;
+    std::vector<double> eye_angle_intervals_ms;
+    double connected_s = 0;
+    bool received_quit = false;
+    std::string error;
+};
+
+static void read_exactly(tcp::socket& socket, void* data, size_t size) {
+    boost::asio::read(socket, boost::asio::buffer(data, size));
+}
+
+// Reads one message and returns its request code
+static int64_t read_message(tcp::socket& socket) {
+    int64_t request_code;
+    read_exactly(socket, &request_code, sizeof(request_code));
+
+    switch (request_code) {
+        case 0: // Show display density test image
+        case 1: // Hide display density test image
+        case 5: // Quit
+            break;
+        case 2: { // Pixels per lens, index of refraction
+            float settings[2];
+            read_exactly(socket, settings, sizeof(settings));
+            break;
+        }
+        case 4: { // Left horizontal, left vertical, right horizontal, right vertical
+            double eye_angles[4];
+            read_exactly(socket, eye_angles, sizeof(eye_angles));
+            break;
+        }
+        case 6: // Object file path
+        case 7: { // Object cache file path
+            int64_t length;
+            read_exactly(socket, &length, sizeof(length));
+            std::string path(length, '\0');
+            read_exactly(socket, path.data(), length);
+            break;
+        }
+        default:
+            throw std::runtime_error("unknown request code " + std::to_string(request_code));
+    }
+
+    return request_code;
+}
+
+static void run_client(int index, const mock_options& options, client_report& report) {
+    bool is_slow = index < options.slow_clients;
+    bool does_disconnect = index >= options.clients - options.disconnect_clients;
+    double lifetime_s = does_disconnect ? options.disconnect_after_s : options.duration_s;
+
+    std::chrono::steady_clock::time_point connect_time = std::chrono::steady_clock::now();
+    std::chrono::steady_clock::time_point end_time = connect_time + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(lifetime_s));
+
+    try {
+        boost::asio::io_context io_context;
+        tcp::socket socket(io_context);
+        socket.connect(tcp::endpoint(boost::asio::ip::make_address(options.host), options.port));
+
+        std::chrono::steady_clock::time_point last_eye_angles_time;
+        bool has_eye_angles = false;
+
+        while (std::chrono::steady_clock::now() < end_time) {
+            // Only block on a read when there is something to read, so the
+            // lifetime is respected even when the controller is idle
+            if (socket.available() == 0) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                continue;
+            }
+
+            int64_t request_code = read_message(socket);
+            std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+            report.message_counts[request_code]++;
+
+            if (request_code == 4) {
+                if (has_eye_angles) {
+                    report.eye_angle_intervals_ms.push_back(std::chrono::duration<double, std::milli>(now - last_eye_angles_time).count());
+                }
+                last_eye_angles_time = now;
+                has_eye_angles = true;
+            } else if (request_code == 5) {
+                report.received_quit = true;
+                break;
+            }
+
+            if (is_slow) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(options.slow_ms));
+            }
+        }
+    } catch (const std::exception& e) {
+        report.error = e.what();
+    }
+
+    report.connected_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - connect_time).count();
+}
+
+static void print_report(int index, const mock_options& options, const client_report& report) {
+    std::string kind = "normal";
+    if (index < options.slow_clients) kind = "slow";
+    if (index >= options.clients - options.disconnect_clients) kind += ", disconnects";
+
+    std::cout << "Client " << index << " (" << kind << "), connected " << report.connected_s << " s" << std::endl;
+
+    for (const auto& [request_code, count] : report.message_counts) {
+        std::cout << "    request code " << request_code << ": " << count << " message(s)" << std::endl;
+    }
+
+    const std::vector<double>& intervals = report.eye_angle_intervals_ms;
+    if (!intervals.empty()) {
+        double sum = 0;
+        for (double interval : intervals) sum += interval;
+        double mean = sum / intervals.size();
+
+        double squared_deviation_sum = 0;
+        for (double interval : intervals) squared_deviation_sum += (interval - mean) * (interval - mean);
+        double jitter = std::sqrt(squared_deviation_sum / intervals.size());
+
+        double max_interval = *std::max_element(intervals.begin(), intervals.end());
+
+        std::cout << "    eye angles: " << report.message_counts.at(4) / report.connected_s << " Hz, "
+            << "interval " << mean << " ms, jitter " << jitter << " ms, max gap " << max_interval << " ms" << std::endl;
+    }
+
+    if (report.received_quit) std::cout << "    received quit" << std::endl;
+    if (!report.error.empty()) std::cout << "    error: " << report.error << std::endl;
+}
+
+int main(int argc, char** argv) {
+    mock_options options;
+
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string argument(argv[i]);
+        std::string value(argv[i + 1]);
+
+        if (argument == "--host") options.host = value;
+        else if (argument == "--port") options.port = (unsigned short)std::stoi(value);
+        else if (argument == "--clients") options.clients = std::stoi(value);
+        else if (argument == "--slow-clients") options.slow_clients = std::stoi(value);
+        else if (argument == "--slow-ms") options.slow_ms = std::stoi(value);
+        else if (argument == "--disconnect-clients") options.disconnect_clients = std::stoi(value);
+        else if (argument == "--disconnect-after") options.disconnect_after_s = std::stod(value);
+        else if (argument == "--duration") options.duration_s = std::stod(value);
+        else {
+            std::cerr << "Unknown option " << argument << std::endl;
+            return 1;
+        }
+    }
+
+    std::vector<client_report> reports(options.clients);
+    std::vector<std::thread> threads;
+
+    for (int i = 0; i < options.clients; i++) {
+        threads.emplace_back(run_client, i, std::cref(options), std::ref(reports[i]));
+    }
+
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+
+    for (int i = 0; i < options.clients; i++) {
+        print_report(i, options, reports[i]);
+    }
+
+    return 0;
+}
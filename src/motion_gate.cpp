@@ -0,0 +1,136 @@
+#include "motion_gate.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+
+#include <opencv2/core.hpp>
+
+#include "shared.hpp"
+
+// Rough width of the thumbnails compared. Shrinking averages away sensor
+// noise.
+const int THUMBNAIL_WIDTH = 160;
+
+// A thumbnail pixel has changed if its brightness moved by more than this
+const double PIXEL_CHANGE_THRESHOLD = 12;
+
+// The search area has changed if more than this fraction of its pixels did
+const double CHANGED_PIXEL_FRACTION = 0.01;
+
+// Detection runs at least this often however still the viewer is
+const int FORCED_DETECTION_INTERVAL_MS = 500;
+
+// Checks between skip ratio reports
+const int SKIP_REPORT_INTERVAL = 600;
+
+static std::atomic<bool> is_gate_enabled{true};
+
+// Only touched on the CV thread. Reused, so the gate does not allocate once
+// the frame size settles. difference is kept at thumbnail size and compared
+// through views, so a search area that changes size does not reallocate it.
+static cv::Mat thumbnail;
+static cv::Mat reference_thumbnail;
+static cv::Mat difference;
+static std::chrono::steady_clock::time_point last_detection_time;
+static int still_checks = 0; // Checks in a row with no change
+static int checks_since_report = 0;
+static int skips_since_report = 0;
+
+void motion_gate::set_enabled(bool is_enabled) {
+    is_gate_enabled = is_enabled;
+}
+
+// Averages each block x block square of the BGR frame into one greyscale
+// thumbnail pixel. cv::resize and cv::cvtColor would do the same but take
+// heap scratch buffers and thread pool jobs on every call.
+static void make_thumbnail(const cv::Mat& frame, int block) {
+    cv::Size thumbnail_size(std::max(1, frame.cols / block), std::max(1, frame.rows / block));
+    if (thumbnail.size() != thumbnail_size) {
+        thumbnail.create(thumbnail_size, CV_8UC1);
+        difference.create(thumbnail_size, CV_8UC1);
+    }
+
+    int block_area = block * block;
+    for (int y = 0; y < thumbnail.rows; y++) {
+        uchar* thumbnail_row = thumbnail.ptr<uchar>(y);
+        for (int x = 0; x < thumbnail.cols; x++) {
+            int sum = 0;
+            for (int row = y * block; row < (y + 1) * block; row++) {
+                const uchar* pixel = frame.ptr<uchar>(row) + x * block * 3;
+                for (int column = 0; column < block; column++, pixel += 3) {
+                    // BT.601 luma weights out of 256
+                    sum += 29 * pixel[0] + 150 * pixel[1] + 77 * pixel[2];
+                }
+            }
+            thumbnail_row[x] = (uchar)(sum / block_area >> 8);
+        }
+    }
+}
+
+// Compares the search area in the thumbnail against the reference
+static bool has_search_area_changed(const cv::Rect& search_bounds, double thumbnail_scale) {
+    cv::Rect area(
+        (int)(search_bounds.x * thumbnail_scale),
+        (int)(search_bounds.y * thumbnail_scale),
+        (int)std::ceil(search_bounds.width * thumbnail_scale),
+        (int)std::ceil(search_bounds.height * thumbnail_scale)
+    );
+    area &= cv::Rect(0, 0, thumbnail.cols, thumbnail.rows);
+    if (area.empty()) return true;
+
+    cv::Mat area_difference = difference(cv::Rect(0, 0, area.width, area.height));
+    cv::absdiff(thumbnail(area), reference_thumbnail(area), area_difference);
+    cv::threshold(area_difference, area_difference, PIXEL_CHANGE_THRESHOLD, 255, cv::THRESH_BINARY);
+
+    return cv::countNonZero(area_difference) > area.area() * CHANGED_PIXEL_FRACTION;
+}
+
+static void report_skip_ratio(bool is_skipped) {
+    checks_since_report++;
+    if (is_skipped) skips_since_report++;
+
+    if (checks_since_report < SKIP_REPORT_INTERVAL) return;
+
+    std::cout << "Motion gate skipped " << skips_since_report * 100 / checks_since_report
+        << "% of detections over the last " << checks_since_report << " frames" << std::endl;
+    checks_since_report = 0;
+    skips_since_report = 0;
+}
+
+bool motion_gate::is_static(const cv::Mat& frame, const cv::Rect& search_bounds) {
+    if (!is_gate_enabled) return false;
+
+    if (frame.type() != CV_8UC3) return false;
+
+    int block = std::max(1, frame.cols / THUMBNAIL_WIDTH);
+    double thumbnail_scale = 1.0 / block;
+    make_thumbnail(frame, block);
+
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+
+    bool is_still = reference_thumbnail.size() == thumbnail.size() && !has_search_area_changed(search_bounds, thumbnail_scale);
+    still_checks = is_still ? still_checks + 1 : 0;
+
+    // The eye angle filter averages the last BUFFER_SIZE poses. Keep
+    // detecting until it only holds poses of the still viewer.
+    bool is_filter_settled = still_checks > shared_vars::BUFFER_SIZE;
+    bool is_detection_due = now - last_detection_time >= std::chrono::milliseconds(FORCED_DETECTION_INTERVAL_MS);
+
+    bool is_skipped = is_still && is_filter_settled && !is_detection_due;
+    report_skip_ratio(is_skipped);
+
+    if (is_skipped) return true;
+
+    // The detector runs on this frame, so later frames are compared with it
+    std::swap(thumbnail, reference_thumbnail);
+    last_detection_time = now;
+    return false;
+}
+
+void motion_gate::reset() {
+    reference_thumbnail.release();
+    still_checks = 0;
+}
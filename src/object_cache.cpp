@@ -0,0 +1,625 @@
+#include "object_cache.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include "shared.hpp"
+#include "renderer_server.hpp"
+
+const char* CACHE_DIRECTORY = "object_cache";
+const char* CACHE_INDEX_FILE = "object_cache/index.txt";
+
+// Number of recently used subjects kept in the index and prefetched at start up
+const size_t RECENT_SUBJECT_COUNT = 8;
+
+const size_t SECTION_ALIGNMENT = 16;
+
+namespace fs = std::filesystem;
+
+const uint64_t FNV_OFFSET_BASIS = 14695981039346656037ULL;
+const uint64_t FNV_PRIME = 1099511628211ULL;
+
+// What is known about a model the last time it was cached. Lets a model be
+// matched to its cache without hashing it again.
+struct cache_index_entry {
+    std::string model_path;
+    std::string material_path; // Empty if the model has no material library
+    std::string texture_path; // Empty if the material has no diffuse texture
+    uint64_t content_hash; // Of the model, material and texture together
+    uint64_t source_stamp; // Of their sizes and modification times
+};
+
+struct cache_task {
+    std::string model_path;
+    bool is_display; // false for prefetch
+};
+
+// Everything below except the task queue is only touched on the cache thread
+static std::list<cache_index_entry> cache_index; // Most recently used first
+
+static std::deque<cache_task> task_queue;
+static std::mutex task_queue_mutex;
+static std::condition_variable task_queue_condition;
+static bool do_cache_thread_run = false;
+static std::thread cache_thread;
+
+// Renderers are only sent cache files when they are known to read them
+static std::atomic<bool> is_renderer_cache_enabled{false};
+
+static void hash_bytes(uint64_t& hash, const void* data, size_t size) {
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= FNV_PRIME;
+    }
+}
+
+uint64_t object_cache::hash_file(const std::string& path, uint64_t hash) {
+    if (fs::file_size(path) == 0) return hash; // Empty files cannot be mapped
+
+    boost::interprocess::file_mapping file(path.c_str(), boost::interprocess::read_only);
+    boost::interprocess::mapped_region region(file, boost::interprocess::read_only);
+    region.advise(boost::interprocess::mapped_region::advice_sequential);
+
+    hash_bytes(hash, region.get_address(), region.get_size());
+    return hash;
+}
+
+static std::string cache_path_for(uint64_t content_hash) {
+    std::ostringstream path;
+    path << CACHE_DIRECTORY << "/" << std::hex << content_hash << ".v" << std::dec << OBJECT_CACHE_VERSION << ".objcache";
+    return path.str();
+}
+
+static bool is_convertible(const std::string& model_path) {
+    std::string extension = fs::path(model_path).extension().string();
+    std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+    return extension == ".obj";
+}
+
+// Paths of the files a cache is built from, the model first
+static std::vector<std::string> source_paths_of(const cache_index_entry& entry) {
+    std::vector<std::string> paths = {entry.model_path};
+    if (!entry.material_path.empty()) paths.push_back(entry.material_path);
+    if (!entry.texture_path.empty()) paths.push_back(entry.texture_path);
+    return paths;
+}
+
+// Cheap fingerprint of the source files, changes when any of them is edited
+static uint64_t source_stamp_of(const std::vector<std::string>& paths) {
+    uint64_t stamp = FNV_OFFSET_BASIS;
+
+    for (const std::string& path : paths) {
+        std::error_code error;
+        uint64_t file_size = fs::file_size(path, error);
+        int64_t modified_time = error ? -1 : fs::last_write_time(path, error).time_since_epoch().count();
+        if (error) file_size = UINT64_MAX; // A missing file is a change too
+
+        hash_bytes(stamp, &file_size, sizeof(file_size));
+        hash_bytes(stamp, &modified_time, sizeof(modified_time));
+    }
+
+    return stamp;
+}
+
+// Reads a face corner like "3", "3/1", "3//2" or "3/1/2" into zero based
+// indices. Missing indices are -1.
+static void parse_face_corner(const std::string& corner, size_t position_count, size_t uv_count, size_t normal_count, int indices[3]) {
+    size_t counts[3] = {position_count, uv_count, normal_count};
+    std::istringstream stream(corner);
+    std::string part;
+
+    for (int i = 0; i < 3; i++) {
+        indices[i] = -1;
+        if (!std::getline(stream, part, '/')) continue;
+        if (part.empty()) continue;
+
+        int index = std::stoi(part);
+        // Negative indices count back from the end
+        indices[i] = index < 0 ? (int)counts[i] + index : index - 1;
+    }
+}
+
+// Path of the diffuse texture of a material in a .mtl file, or empty. An
+// empty material name means the first material.
+static std::string find_diffuse_texture(const fs::path& material_path, const std::string& material_name) {
+    std::ifstream material_file(material_path);
+    std::string line;
+    bool is_in_material = material_name.empty();
+
+    while (std::getline(material_file, line)) {
+        std::istringstream stream(line);
+        std::string keyword;
+        stream >> keyword;
+
+        if (keyword == "newmtl") {
+            if (is_in_material && !material_name.empty()) break; // Past the material, it has no texture
+            std::string name;
+            std::getline(stream >> std::ws, name);
+            is_in_material = material_name.empty() || name == material_name;
+        } else if (keyword == "map_Kd" && is_in_material) {
+            std::string texture_name;
+            std::getline(stream >> std::ws, texture_name);
+            return (material_path.parent_path() / texture_name).string();
+        }
+    }
+
+    return "";
+}
+
+// Material library and diffuse texture used by a model, empty if it has
+// none. Returns false if the model uses more than one material library or
+// material: a cache file holds one mesh with one texture, so it could not be
+// displayed the same as the model.
+static bool find_model_sources(const std::string& model_path, std::string& material_path, std::string& texture_path) {
+    std::ifstream model_file(model_path);
+    std::string line;
+    std::set<std::string> material_libraries;
+    std::set<std::string> material_names;
+
+    while (std::getline(model_file, line)) {
+        std::istringstream stream(line);
+        std::string keyword;
+        stream >> keyword;
+
+        std::string name;
+        if (keyword == "mtllib") {
+            std::getline(stream >> std::ws, name);
+            material_libraries.insert(name);
+        } else if (keyword == "usemtl") {
+            std::getline(stream >> std::ws, name);
+            material_names.insert(name);
+        }
+    }
+
+    material_path.clear();
+    texture_path.clear();
+    if (material_libraries.size() > 1 || material_names.size() > 1) return false;
+    if (material_libraries.empty()) return true;
+
+    material_path = (fs::path(model_path).parent_path() / *material_libraries.begin()).string();
+    texture_path = find_diffuse_texture(material_path, material_names.empty() ? "" : *material_names.begin());
+    return true;
+}
+
+static bool parse_obj(
+    const std::string& model_path,
+    std::vector<object_cache_vertex>& vertices,
+    std::vector<uint32_t>& indices
+) {
+    std::ifstream model_file(model_path);
+    if (!model_file.is_open()) return false;
+
+    std::vector<std::array<float, 3>> positions;
+    std::vector<std::array<float, 2>> uvs;
+    std::vector<std::array<float, 3>> normals;
+
+    // Each distinct position/uv/normal combination becomes one vertex
+    std::map<std::array<int, 3>, uint32_t> vertex_lookup;
+
+    std::string line;
+    while (std::getline(model_file, line)) {
+        std::istringstream stream(line);
+        std::string keyword;
+        stream >> keyword;
+
+        if (keyword == "v") {
+            std::array<float, 3> position;
+            stream >> position[0] >> position[1] >> position[2];
+            positions.push_back(position);
+        } else if (keyword == "vt") {
+            std::array<float, 2> uv;
+            stream >> uv[0] >> uv[1];
+            uvs.push_back(uv);
+        } else if (keyword == "vn") {
+            std::array<float, 3> normal;
+            stream >> normal[0] >> normal[1] >> normal[2];
+            normals.push_back(normal);
+        } else if (keyword == "f") {
+            std::vector<uint32_t> face;
+            std::string corner;
+
+            while (stream >> corner) {
+                std::array<int, 3> corner_indices;
+                parse_face_corner(corner, positions.size(), uvs.size(), normals.size(), corner_indices.data());
+                if (corner_indices[0] < 0 || corner_indices[0] >= (int)positions.size()) return false;
+
+                auto found = vertex_lookup.find(corner_indices);
+                if (found != vertex_lookup.end()) {
+                    face.push_back(found->second);
+                    continue;
+                }
+
+                object_cache_vertex vertex = {};
+                std::copy(positions[corner_indices[0]].begin(), positions[corner_indices[0]].end(), vertex.position);
+                if (corner_indices[1] >= 0 && corner_indices[1] < (int)uvs.size()) {
+                    std::copy(uvs[corner_indices[1]].begin(), uvs[corner_indices[1]].end(), vertex.uv);
+                }
+                if (corner_indices[2] >= 0 && corner_indices[2] < (int)normals.size()) {
+                    std::copy(normals[corner_indices[2]].begin(), normals[corner_indices[2]].end(), vertex.normal);
+                }
+
+                uint32_t vertex_index = (uint32_t)vertices.size();
+                vertices.push_back(vertex);
+                vertex_lookup.emplace(corner_indices, vertex_index);
+                face.push_back(vertex_index);
+            }
+
+            // Split polygons into a fan of triangles
+            for (size_t i = 1; i + 1 < face.size(); i++) {
+                indices.push_back(face[0]);
+                indices.push_back(face[i]);
+                indices.push_back(face[i + 1]);
+            }
+        }
+    }
+
+    return !indices.empty();
+}
+
+static uint64_t align_section(uint64_t offset) {
+    return (offset + SECTION_ALIGNMENT - 1) / SECTION_ALIGNMENT * SECTION_ALIGNMENT;
+}
+
+static void write_padding(std::ofstream& file, uint64_t target_offset) {
+    static const char zeros[SECTION_ALIGNMENT] = {};
+    uint64_t current_offset = (uint64_t)file.tellp();
+    file.write(zeros, target_offset - current_offset);
+}
+
+bool object_cache::build(const std::string& model_path, const std::string& cache_path, uint64_t content_hash) {
+    if (!is_convertible(model_path)) return false;
+
+    std::string material_path;
+    std::string texture_path;
+    if (!find_model_sources(model_path, material_path, texture_path)) {
+        std::cout << "Not caching " << model_path << ", it uses more than one material" << std::endl;
+        return false;
+    }
+
+    std::vector<object_cache_vertex> vertices;
+    std::vector<uint32_t> indices;
+
+    try {
+        if (!parse_obj(model_path, vertices, indices)) return false;
+    } catch (const std::exception& e) {
+        std::cerr << "Invalid model " << model_path << ": " << e.what() << std::endl;
+        return false;
+    }
+
+    cv::Mat texture;
+    if (!texture_path.empty()) {
+        // Unchanged, so an alpha channel is not silently dropped
+        cv::Mat loaded_texture = cv::imread(texture_path, cv::IMREAD_UNCHANGED);
+        if (loaded_texture.empty()) {
+            std::cerr << "Could not load texture " << texture_path << std::endl;
+        } else if (loaded_texture.channels() == 2 || loaded_texture.channels() == 4) {
+            // Cache textures are stored opaque, so the model goes by path to keep its transparency
+            std::cout << "Not caching " << model_path << ", its texture has an alpha channel" << std::endl;
+            return false;
+        } else {
+            if (loaded_texture.depth() == CV_16U) {
+                loaded_texture.convertTo(loaded_texture, CV_8U, 255.0 / 65535.0);
+            }
+            cv::cvtColor(loaded_texture, texture, loaded_texture.channels() == 1 ? cv::COLOR_GRAY2RGBA : cv::COLOR_BGR2RGBA);
+        }
+    }
+
+    object_cache_header header = {};
+    std::memcpy(header.magic, OBJECT_CACHE_MAGIC, sizeof(header.magic));
+    header.version = OBJECT_CACHE_VERSION;
+    header.flags = OBJECT_CACHE_HAS_MESH | (texture.empty() ? 0 : OBJECT_CACHE_HAS_TEXTURE);
+    header.content_hash = content_hash;
+    header.vertex_count = vertices.size();
+    header.vertex_offset = align_section(sizeof(object_cache_header));
+    header.index_count = indices.size();
+    header.index_offset = align_section(header.vertex_offset + vertices.size() * sizeof(object_cache_vertex));
+    header.texture_width = texture.cols;
+    header.texture_height = texture.rows;
+    header.texture_offset = align_section(header.index_offset + indices.size() * sizeof(uint32_t));
+
+    // Write to a temporary file first, a half written cache must never be
+    // picked up by the renderer
+    std::string temporary_path = cache_path + ".tmp";
+    std::ofstream cache_file(temporary_path, std::ios::binary | std::ios::trunc);
+    if (!cache_file.is_open()) return false;
+
+    cache_file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    write_padding(cache_file, header.vertex_offset);
+    cache_file.write(reinterpret_cast<const char*>(vertices.data()), vertices.size() * sizeof(object_cache_vertex));
+    write_padding(cache_file, header.index_offset);
+    cache_file.write(reinterpret_cast<const char*>(indices.data()), indices.size() * sizeof(uint32_t));
+    write_padding(cache_file, header.texture_offset);
+    for (int row = 0; row < texture.rows; row++) {
+        cache_file.write(reinterpret_cast<const char*>(texture.ptr(row)), texture.cols * 4);
+    }
+
+    cache_file.close();
+    if (!cache_file) return false;
+
+    std::error_code error;
+    fs::rename(temporary_path, cache_path, error);
+    return !error;
+}
+
+// Checks that a cache file is current and asks the kernel to read it ahead
+// into the page cache, so the renderer's own mapping of it starts warm. Only
+// a readahead hint, nothing keeps the pages resident. Returns false if the
+// file is missing or out of date.
+static bool prefetch_cache(const std::string& cache_path, uint64_t content_hash) {
+    if (!fs::exists(cache_path) || fs::file_size(cache_path) < sizeof(object_cache_header)) return false;
+
+    boost::interprocess::file_mapping file(cache_path.c_str(), boost::interprocess::read_only);
+    boost::interprocess::mapped_region region(file, boost::interprocess::read_only);
+
+    const object_cache_header* header = static_cast<const object_cache_header*>(region.get_address());
+    if (std::memcmp(header->magic, OBJECT_CACHE_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != OBJECT_CACHE_VERSION ||
+        header->content_hash != content_hash) {
+        return false;
+    }
+
+    region.advise(boost::interprocess::mapped_region::advice_willneed);
+    return true;
+}
+
+// One entry per line, tab separated: content hash, source stamp, model path,
+// material path, texture path
+static void load_cache_index() {
+    std::ifstream index_file(CACHE_INDEX_FILE);
+    std::string line;
+
+    while (std::getline(index_file, line)) {
+        std::istringstream stream(line);
+        std::string content_hash;
+        std::string source_stamp;
+        cache_index_entry entry;
+
+        if (!std::getline(stream, content_hash, '\t') ||
+            !std::getline(stream, source_stamp, '\t') ||
+            !std::getline(stream, entry.model_path, '\t') ||
+            !std::getline(stream, entry.material_path, '\t')) {
+            continue; // Older index layout, the model is hashed again
+        }
+        std::getline(stream, entry.texture_path);
+
+        try {
+            entry.content_hash = std::stoull(content_hash, nullptr, 16);
+            entry.source_stamp = std::stoull(source_stamp, nullptr, 16);
+        } catch (const std::logic_error&) {
+            continue;
+        }
+
+        cache_index.push_back(entry);
+    }
+}
+
+static void save_cache_index() {
+    std::ofstream index_file(CACHE_INDEX_FILE, std::ios::trunc);
+
+    for (const cache_index_entry& entry : cache_index) {
+        index_file << std::hex << entry.content_hash << "\t" << entry.source_stamp << std::dec << "\t"
+            << entry.model_path << "\t" << entry.material_path << "\t" << entry.texture_path << "\n";
+    }
+}
+
+// Deletes a cache file unless another index entry still uses it
+static void remove_cache_if_unused(uint64_t content_hash) {
+    bool is_used = std::any_of(cache_index.begin(), cache_index.end(), [&](const cache_index_entry& entry) {
+        return entry.content_hash == content_hash;
+    });
+    if (is_used) return;
+
+    std::error_code error;
+    fs::remove(cache_path_for(content_hash), error);
+}
+
+// Deletes cache files left behind by older versions or interrupted builds
+static void remove_unindexed_caches() {
+    std::set<fs::path> indexed_files;
+    for (const cache_index_entry& entry : cache_index) {
+        indexed_files.insert(fs::path(cache_path_for(entry.content_hash)).filename());
+    }
+
+    std::error_code error;
+    for (const fs::directory_entry& file : fs::directory_iterator(CACHE_DIRECTORY, error)) {
+        fs::path extension = file.path().extension();
+        if ((extension == ".objcache" || extension == ".tmp") && !indexed_files.count(file.path().filename())) {
+            fs::remove(file.path(), error);
+        }
+    }
+}
+
+// Returns the cache path for a model, converting it first if needed. Returns
+// empty if the model cannot be converted. Displayed models move to the front
+// of the recently used list, prefetched ones keep their place.
+static std::string prepare_cache(const std::string& model_path, bool is_display) {
+    if (!is_convertible(model_path)) return "";
+
+    auto found = std::find_if(cache_index.begin(), cache_index.end(), [&](const cache_index_entry& entry) {
+        return entry.model_path == model_path;
+    });
+
+    cache_index_entry entry;
+    if (found != cache_index.end() && found->source_stamp == source_stamp_of(source_paths_of(*found))) {
+        entry = *found;
+    } else {
+        // New or edited, the material or texture may have changed too
+        entry.model_path = model_path;
+        if (!find_model_sources(model_path, entry.material_path, entry.texture_path)) {
+            std::cout << "Not caching " << model_path << ", it uses more than one material" << std::endl;
+            return "";
+        }
+
+        std::vector<std::string> source_paths = source_paths_of(entry);
+        entry.source_stamp = source_stamp_of(source_paths);
+        entry.content_hash = FNV_OFFSET_BASIS;
+        for (const std::string& path : source_paths) {
+            if (fs::exists(path)) entry.content_hash = object_cache::hash_file(path, entry.content_hash);
+        }
+    }
+
+    std::string cache_path = cache_path_for(entry.content_hash);
+    bool is_cached = prefetch_cache(cache_path, entry.content_hash);
+
+    if (!is_cached) {
+        std::chrono::steady_clock::time_point build_start = std::chrono::steady_clock::now();
+
+        if (!object_cache::build(model_path, cache_path, entry.content_hash)) {
+            return "";
+        }
+
+        std::cout << "Cached " << model_path << " in " << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - build_start).count() << " ms" << std::endl;
+        prefetch_cache(cache_path, entry.content_hash);
+    }
+
+    // Only models that could be converted are worth remembering
+    uint64_t replaced_hash = found != cache_index.end() ? found->content_hash : entry.content_hash;
+
+    if (found != cache_index.end() && !is_display) {
+        *found = entry;
+    } else {
+        if (found != cache_index.end()) cache_index.erase(found);
+
+        cache_index.push_front(entry);
+        if (cache_index.size() > RECENT_SUBJECT_COUNT) {
+            uint64_t evicted_hash = cache_index.back().content_hash;
+            cache_index.pop_back();
+            remove_cache_if_unused(evicted_hash);
+        }
+    }
+
+    // The model's previous cache is stale once it has been edited
+    if (replaced_hash != entry.content_hash) {
+        remove_cache_if_unused(replaced_hash);
+    }
+    save_cache_index();
+
+    return cache_path;
+}
+
+static void send_subject_to_renderer(const std::string& model_path, const std::string& cache_path) {
+    std::vector<uint8_t> message;
+
+    if (cache_path.empty() || !is_renderer_cache_enabled) {
+        // Not converted, the renderer parses the model itself
+        message = renderer_server::make_message(6);
+        renderer_server::append(message, (int64_t)model_path.length());
+        renderer_server::append(message, model_path);
+    } else {
+        std::string absolute_cache_path = fs::absolute(cache_path).string();
+        message = renderer_server::make_message(7);
+        renderer_server::append(message, (int64_t)absolute_cache_path.length());
+        renderer_server::append(message, absolute_cache_path);
+    }
+
+    // Both request codes set the current subject, so they replace each other
+    renderer_server::send_and_remember(std::move(message), 6);
+}
+
+static void run_cache_thread() {
+    while (true) {
+        cache_task task;
+        {
+            std::unique_lock<std::mutex> lock(task_queue_mutex);
+            task_queue_condition.wait(lock, []() { return !do_cache_thread_run || !task_queue.empty(); });
+            if (!do_cache_thread_run) return;
+
+            task = task_queue.front();
+            task_queue.pop_front();
+        }
+
+        std::string cache_path;
+        try {
+            cache_path = prepare_cache(task.model_path, task.is_display);
+        } catch (const std::exception& e) {
+            std::cerr << "Could not cache " << task.model_path << ": " << e.what() << std::endl;
+        }
+
+        if (task.is_display) {
+            send_subject_to_renderer(task.model_path, cache_path);
+        }
+    }
+}
+
+void object_cache::start() {
+    // Without renderer support subjects go out by path from display, and the
+    // cache directory is left alone
+    if (!is_renderer_cache_enabled) return;
+
+    std::error_code error;
+    fs::create_directories(CACHE_DIRECTORY, error);
+
+    load_cache_index();
+    remove_unindexed_caches();
+
+    do_cache_thread_run = true;
+
+    // Prefetch while nothing else is queued, subject switches go ahead of these
+    for (const cache_index_entry& entry : cache_index) {
+        if (fs::exists(entry.model_path)) {
+            task_queue.push_back({entry.model_path, false});
+        }
+    }
+
+    cache_thread = std::thread(run_cache_thread);
+}
+
+void object_cache::set_renderer_cache_enabled(bool is_enabled) {
+    is_renderer_cache_enabled = is_enabled;
+}
+
+void object_cache::stop() {
+    {
+        std::lock_guard<std::mutex> lock(task_queue_mutex);
+        do_cache_thread_run = false;
+    }
+    task_queue_condition.notify_one();
+
+    if (cache_thread.joinable()) {
+        cache_thread.join();
+    }
+}
+
+void object_cache::display(const std::string& model_path) {
+    // Without renderer support a cache would only delay the switch
+    if (!is_renderer_cache_enabled) {
+        send_subject_to_renderer(model_path, "");
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(task_queue_mutex);
+
+        // Only the newest selection matters, drop any that have not started
+        task_queue.erase(std::remove_if(task_queue.begin(), task_queue.end(), [](const cache_task& task) {
+            return task.is_display;
+        }), task_queue.end());
+
+        task_queue.push_front({model_path, true});
+    }
+    task_queue_condition.notify_one();
+}
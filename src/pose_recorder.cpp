@@ -0,0 +1,271 @@
+#include "pose_recorder.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "shared.hpp"
+#include "renderer_server.hpp"
+
+// Records queued between flushes. At 60 frames per second this is over a
+// minute of headroom if the disk stalls.
+const size_t RECORD_QUEUE_CAPACITY = 4096;
+const int FLUSH_INTERVAL_MS = 100;
+
+// A log stops growing at this size, about two and a half hours at 60 frames
+// per second
+const uint64_t MAX_LOG_BYTES = 64ull * 1024 * 1024;
+
+// Session logs kept in the log directory, oldest are deleted first
+const size_t MAX_KEPT_SESSION_LOGS = 10;
+
+// Longest a replay sleeps before checking whether it should stop
+const int REPLAY_STOP_CHECK_MS = 50;
+
+// Single producer, single consumer ring. The CV thread pushes, the flush
+// thread pops.
+static std::array<pose_record, RECORD_QUEUE_CAPACITY> record_queue;
+static std::atomic<size_t> queue_head{0}; // Next slot the CV thread writes
+static std::atomic<size_t> queue_tail{0}; // Next slot the flush thread reads
+
+static std::ofstream log_file;
+static std::thread flush_thread;
+static std::atomic<bool> do_flush_thread_run{false};
+static std::atomic<uint64_t> dropped_record_count{0};
+static uint64_t log_bytes_written = 0; // Only touched by the flush thread once started
+static bool is_log_full = false;
+static std::chrono::steady_clock::time_point recording_start_time;
+
+static void flush_queue() {
+    size_t tail = queue_tail.load(std::memory_order_relaxed);
+    size_t head = queue_head.load(std::memory_order_acquire);
+
+    while (tail != head) {
+        // Write the contiguous run up to the head or the end of the ring
+        size_t run_end = head > tail ? head : RECORD_QUEUE_CAPACITY;
+        uint64_t run_bytes = (run_end - tail) * sizeof(pose_record);
+
+        if (log_bytes_written + run_bytes > MAX_LOG_BYTES) {
+            if (!is_log_full) {
+                is_log_full = true;
+                std::cout << "Pose log reached " << MAX_LOG_BYTES / (1024 * 1024) << " MB, no longer recording" << std::endl;
+            }
+        } else {
+            log_file.write(reinterpret_cast<const char*>(&record_queue[tail]), run_bytes);
+            log_bytes_written += run_bytes;
+        }
+
+        tail = run_end % RECORD_QUEUE_CAPACITY;
+        queue_tail.store(tail, std::memory_order_release);
+    }
+
+    log_file.flush();
+}
+
+static void run_flush_thread() {
+    while (do_flush_thread_run) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(FLUSH_INTERVAL_MS));
+        flush_queue();
+    }
+
+    flush_queue();
+}
+
+// Deletes the oldest session logs in a directory so at most keep_count remain,
+// leaving room for the one about to be started
+static void remove_old_session_logs(const std::filesystem::path& directory, size_t keep_count) {
+    std::error_code error;
+    std::vector<std::filesystem::path> session_logs;
+
+    for (const std::filesystem::directory_entry& entry : std::filesystem::directory_iterator(directory, error)) {
+        std::string name = entry.path().filename().string();
+        if (name.rfind("session-", 0) == 0 && entry.path().extension() == ".poselog") {
+            session_logs.push_back(entry.path());
+        }
+    }
+
+    if (session_logs.size() < keep_count) return;
+
+    // Names sort by start time
+    std::sort(session_logs.begin(), session_logs.end());
+    for (size_t i = 0; i + keep_count <= session_logs.size(); i++) {
+        std::filesystem::remove(session_logs[i], error);
+    }
+}
+
+bool pose_recorder::start(const std::string& path) {
+    std::filesystem::path parent = std::filesystem::path(path).parent_path();
+    if (!parent.empty()) {
+        std::error_code error;
+        std::filesystem::create_directories(parent, error);
+    }
+    remove_old_session_logs(parent.empty() ? std::filesystem::path(".") : parent, MAX_KEPT_SESSION_LOGS);
+
+    log_file.open(path, std::ios::binary | std::ios::trunc);
+    if (!log_file.is_open()) {
+        std::cerr << "Error: Could not open pose log " << path << std::endl;
+        return false;
+    }
+
+    pose_log_header header;
+    std::memcpy(header.magic, POSE_LOG_MAGIC, sizeof(header.magic));
+    header.version = POSE_LOG_VERSION;
+    header.record_size = sizeof(pose_record);
+    header.start_unix_time_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()
+    ).count();
+    log_file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    log_bytes_written = sizeof(header);
+    is_log_full = false;
+
+    recording_start_time = std::chrono::steady_clock::now();
+    do_flush_thread_run = true;
+    flush_thread = std::thread(run_flush_thread);
+
+    std::cout << "Recording poses to " << path << std::endl;
+    return true;
+}
+
+void pose_recorder::record(pose_record& record) {
+    if (!do_flush_thread_run) return;
+
+    record.timestamp_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - recording_start_time
+    ).count();
+
+    size_t head = queue_head.load(std::memory_order_relaxed);
+    size_t next_head = (head + 1) % RECORD_QUEUE_CAPACITY;
+
+    if (next_head == queue_tail.load(std::memory_order_acquire)) {
+        dropped_record_count++;
+        return;
+    }
+
+    record_queue[head] = record;
+    queue_head.store(next_head, std::memory_order_release);
+}
+
+void pose_recorder::stop() {
+    if (!do_flush_thread_run) return;
+
+    do_flush_thread_run = false;
+    flush_thread.join();
+    log_file.close();
+
+    if (dropped_record_count > 0) {
+        std::cout << "Pose recorder dropped " << dropped_record_count << " records" << std::endl;
+    }
+}
+
+std::string pose_recorder::default_log_path() {
+    std::time_t now = std::time(nullptr);
+    char time_string[32];
+    std::strftime(time_string, sizeof(time_string), "%Y%m%d-%H%M%S", std::localtime(&now));
+
+    return std::string("pose_logs/session-") + time_string + ".poselog";
+}
+
+// Sleeps until the deadline in short steps. Returns false early if the CV
+// thread is asked to stop.
+static bool sleep_until_or_stopped(std::chrono::steady_clock::time_point deadline) {
+    while (shared_vars::do_cv_thread_run) {
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        if (now >= deadline) return true;
+
+        std::this_thread::sleep_for(std::min<std::chrono::steady_clock::duration>(deadline - now, std::chrono::milliseconds(REPLAY_STOP_CHECK_MS)));
+    }
+
+    return false;
+}
+
+void pose_recorder::replay(const std::string& path, bool is_refiltered) {
+    try {
+        pose_log_reader reader(path);
+        std::cout << "Replaying " << reader.size() << " records from " << path
+            << (is_refiltered ? " through the current filter" : "") << std::endl;
+
+        // Wait for the renderer, otherwise the start of the log is lost
+        while (shared_vars::do_cv_thread_run && !shared_vars::is_renderer_active) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(REPLAY_STOP_CHECK_MS));
+        }
+
+        // Timing counts from the first pose, so the start up of the recorded
+        // session is not waited out again
+        std::chrono::steady_clock::time_point replay_start_time;
+        int64_t first_timestamp_ns = -1;
+
+        for (size_t i = 0; i < reader.size(); i++) {
+            const pose_record& record = reader[i];
+            if (!(record.flags & POSE_RECORD_HAS_POSE)) continue;
+
+            if (first_timestamp_ns < 0) {
+                first_timestamp_ns = record.timestamp_ns;
+                replay_start_time = std::chrono::steady_clock::now();
+            }
+
+            if (!sleep_until_or_stopped(replay_start_time + std::chrono::nanoseconds(record.timestamp_ns - first_timestamp_ns))) {
+                std::cout << "Replay stopped" << std::endl;
+                return;
+            }
+
+            double eye_angles[4];
+            if (is_refiltered) {
+                shared_vars::filter_eye_angles(record.raw_eye_angles, eye_angles);
+            } else {
+                std::copy(record.filtered_eye_angles, record.filtered_eye_angles + 4, eye_angles);
+            }
+
+            if (shared_vars::is_renderer_active) {
+                renderer_server::send_eye_angles(eye_angles);
+            }
+        }
+
+        std::cout << "Replay finished" << std::endl;
+    } catch (const std::exception& e) {
+        std::cerr << "Error: Could not replay pose log: " << e.what() << std::endl;
+    }
+}
+
+pose_log_reader::pose_log_reader(const std::string& path) :
+    file(path.c_str(), boost::interprocess::read_only),
+    region(file, boost::interprocess::read_only)
+{
+    if (region.get_size() < sizeof(pose_log_header)) {
+        throw std::runtime_error("file too small for a pose log header");
+    }
+
+    const pose_log_header& log_header = header();
+    if (std::memcmp(log_header.magic, POSE_LOG_MAGIC, sizeof(POSE_LOG_MAGIC)) != 0) {
+        throw std::runtime_error("not a pose log");
+    }
+    if (log_header.version != POSE_LOG_VERSION || log_header.record_size != sizeof(pose_record)) {
+        throw std::runtime_error("unsupported pose log version " + std::to_string(log_header.version));
+    }
+
+    // A trailing partial record means the program was killed mid write, ignore it
+    records = reinterpret_cast<const pose_record*>(static_cast<const char*>(region.get_address()) + sizeof(pose_log_header));
+    record_count = (region.get_size() - sizeof(pose_log_header)) / sizeof(pose_record);
+
+    region.advise(boost::interprocess::mapped_region::advice_sequential);
+}
+
+const pose_log_header& pose_log_reader::header() const {
+    return *static_cast<const pose_log_header*>(region.get_address());
+}
+
+size_t pose_log_reader::size() const {
+    return record_count;
+}
+
+const pose_record& pose_log_reader::operator[](size_t index) const {
+    return records[index];
+}
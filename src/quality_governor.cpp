@@ -0,0 +1,100 @@
+#include "quality_governor.hpp"
+
+#include <atomic>
+#include <iostream>
+#include <sstream>
+
+#include "cv_actions.hpp"
+
+// Highest quality first. Level 1 matches the fixed settings used before the
+// governor, level 0 spends spare time on a wider search area so fast head
+// movements are not lost.
+static const quality_decision QUALITY_LEVELS[] = {
+    {0, 1.0f, 2.0f, 1, 1},
+    {1, 1.0f, SEARCH_AREA_SIZE, 1, 1},
+    {2, 0.75f, SEARCH_AREA_SIZE, 1, 2},
+    {3, 0.5f, 1.4f, 1, 2},
+    {4, 0.5f, 1.3f, 2, 3},
+    {5, 0.35f, 1.25f, 2, 4},
+    {6, 0.35f, 1.25f, 3, 6},
+};
+static const int QUALITY_LEVEL_COUNT = sizeof(QUALITY_LEVELS) / sizeof(QUALITY_LEVELS[0]);
+static const int DEFAULT_QUALITY_LEVEL = 1;
+
+// Frame time smoothing, higher reacts faster
+const double FRAME_TIME_SMOOTHING = 0.1;
+
+// Step down after this many frames over budget, step up after this many
+// frames comfortably under it. Stepping up is deliberately slow.
+const int FRAMES_BEFORE_STEP_DOWN = 10;
+const int FRAMES_BEFORE_STEP_UP = 90;
+const double STEP_UP_BUDGET_FRACTION = 0.6;
+
+static std::atomic<double> latency_budget_ms{20.0};
+static std::atomic<int> current_level{DEFAULT_QUALITY_LEVEL};
+
+// Only touched on the CV thread
+static double smoothed_frame_ms = 0;
+static bool has_frame_time = false;
+static int frames_over_budget = 0;
+static int frames_under_budget = 0;
+
+void quality_governor::set_latency_budget_ms(double budget_ms) {
+    latency_budget_ms = budget_ms;
+}
+
+bool quality_governor::report_frame_time(double frame_ms) {
+    if (!has_frame_time) {
+        smoothed_frame_ms = frame_ms;
+        has_frame_time = true;
+    } else {
+        smoothed_frame_ms += FRAME_TIME_SMOOTHING * (frame_ms - smoothed_frame_ms);
+    }
+
+    double budget_ms = latency_budget_ms;
+
+    if (smoothed_frame_ms > budget_ms) {
+        frames_over_budget++;
+        frames_under_budget = 0;
+    } else if (smoothed_frame_ms < budget_ms * STEP_UP_BUDGET_FRACTION) {
+        frames_under_budget++;
+        frames_over_budget = 0;
+    } else {
+        // Inside the dead band, hold the current level
+        frames_over_budget = 0;
+        frames_under_budget = 0;
+    }
+
+    int level = current_level;
+    int new_level = level;
+
+    if (frames_over_budget >= FRAMES_BEFORE_STEP_DOWN && level < QUALITY_LEVEL_COUNT - 1) {
+        new_level = level + 1;
+    } else if (frames_under_budget >= FRAMES_BEFORE_STEP_UP && level > 0) {
+        new_level = level - 1;
+    }
+
+    if (new_level == level) return false;
+
+    frames_over_budget = 0;
+    frames_under_budget = 0;
+    current_level = new_level;
+
+    std::cout << "Frame time " << smoothed_frame_ms << " ms against a " << budget_ms << " ms budget. "
+        << quality_governor::describe(QUALITY_LEVELS[new_level]) << std::endl;
+    return true;
+}
+
+quality_decision quality_governor::current() {
+    return QUALITY_LEVELS[current_level];
+}
+
+std::string quality_governor::describe(const quality_decision& decision) {
+    std::ostringstream description;
+    description << "Quality level " << decision.level
+        << ": detector scale " << decision.detector_scale
+        << ", search area " << decision.search_area_size << "x"
+        << ", detect every " << decision.detection_interval << " frame(s)"
+        << ", preview every " << decision.preview_interval << " frame(s)";
+    return description.str();
+}
@@ -0,0 +1,358 @@
+#include "renderer_server.hpp"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstring>
+#include <deque>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <thread>
+
+#include "shared.hpp"
+#include "startup.hpp"
+
+// A client this far behind on ordered messages is considered stalled
+const size_t MAX_QUEUED_MESSAGES = 256;
+const int SHUTDOWN_DRAIN_TIMEOUT_MS = 500;
+
+const size_t EYE_ANGLES_MESSAGE_SIZE = sizeof(int64_t) + 4 * sizeof(double);
+
+using boost::asio::ip::tcp;
+
+class renderer_client;
+
+// Everything below is only touched on the server thread
+static std::set<std::shared_ptr<renderer_client>> clients;
+static std::map<int64_t, std::vector<uint8_t>> remembered_messages;
+static bool is_shutting_down = false;
+static std::promise<void> all_clients_closed;
+
+static std::thread server_thread;
+static std::atomic<size_t> connected_client_count{0};
+
+static void remove_client(const std::shared_ptr<renderer_client>& client);
+
+class renderer_client : public std::enable_shared_from_this<renderer_client> {
+public:
+    explicit renderer_client(tcp::socket socket) : socket(std::move(socket)) {}
+
+    void start() {
+        read_until_closed();
+    }
+
+    void queue(const std::vector<uint8_t>& message) {
+        if (queued_messages.size() >= MAX_QUEUED_MESSAGES) {
+            std::cout << "Renderer client stalled, disconnecting" << std::endl;
+            close();
+            return;
+        }
+
+        queued_messages.push_back(message);
+        write_next();
+    }
+
+    void queue_eye_angles(const std::array<uint8_t, EYE_ANGLES_MESSAGE_SIZE>& message) {
+        // Replaces any pose that has not been written yet
+        pending_eye_angles = message;
+        has_pending_eye_angles = true;
+        write_next();
+    }
+
+    void close() {
+        if (is_closed) return;
+        is_closed = true;
+
+        boost::system::error_code error;
+        socket.shutdown(tcp::socket::shutdown_both, error);
+        socket.close(error);
+
+        // Deferred so callers can close clients while looping over them
+        boost::asio::post(shared_vars::io_context, [self = shared_from_this()]() {
+            remove_client(self);
+        });
+    }
+
+private:
+    void write_next() {
+        if (is_writing || is_closed) return;
+
+        boost::asio::const_buffer buffer;
+
+        // Ordered messages go first, they may change how the pose is drawn
+        if (!queued_messages.empty()) {
+            buffer = boost::asio::buffer(queued_messages.front());
+            is_writing_eye_angles = false;
+        } else if (has_pending_eye_angles) {
+            eye_angles_in_flight = pending_eye_angles;
+            has_pending_eye_angles = false;
+            buffer = boost::asio::buffer(eye_angles_in_flight);
+            is_writing_eye_angles = true;
+        } else {
+            if (is_shutting_down) close();
+            return;
+        }
+
+        is_writing = true;
+        boost::asio::async_write(socket, buffer,
+            [self = shared_from_this()](const boost::system::error_code& error, size_t) {
+                self->is_writing = false;
+
+                if (error) {
+                    std::cout << "Socket disconnected: " << error.message() << std::endl;
+                    self->close();
+                    return;
+                }
+
+                if (!self->is_writing_eye_angles) {
+                    self->queued_messages.pop_front();
+                }
+
+                self->write_next();
+            }
+        );
+    }
+
+    void read_until_closed() {
+        // The renderer does not send anything yet, reading is only to notice
+        // when it goes away.
+        socket.async_read_some(boost::asio::buffer(read_buffer),
+            [self = shared_from_this()](const boost::system::error_code& error, size_t) {
+                if (error) {
+                    if (error != boost::asio::error::operation_aborted) {
+                        std::cout << "Socket disconnected: " << error.message() << std::endl;
+                    }
+                    self->close();
+                    return;
+                }
+
+                self->read_until_closed();
+            }
+        );
+    }
+
+    tcp::socket socket;
+    std::deque<std::vector<uint8_t>> queued_messages;
+    std::array<uint8_t, EYE_ANGLES_MESSAGE_SIZE> pending_eye_angles;
+    std::array<uint8_t, EYE_ANGLES_MESSAGE_SIZE> eye_angles_in_flight;
+    std::array<uint8_t, 64> read_buffer;
+    bool has_pending_eye_angles = false;
+    bool is_writing = false;
+    bool is_writing_eye_angles = false;
+    bool is_closed = false;
+};
+
+static void remove_client(const std::shared_ptr<renderer_client>& client) {
+    clients.erase(client);
+    connected_client_count = clients.size();
+    shared_vars::is_renderer_active = !clients.empty();
+
+    if (is_shutting_down && clients.empty()) {
+        all_clients_closed.set_value();
+    }
+}
+
+static void accept_next_client() {
+    shared_vars::acceptor.async_accept([](const boost::system::error_code& error, tcp::socket socket) {
+        if (error) {
+            if (error != boost::asio::error::operation_aborted) {
+                std::cerr << "Error accepting renderer: " << error.message() << std::endl;
+                accept_next_client();
+            }
+            return;
+        }
+
+        boost::system::error_code option_error;
+        socket.set_option(tcp::no_delay(true), option_error);
+
+        std::shared_ptr<renderer_client> client = std::make_shared<renderer_client>(std::move(socket));
+        clients.insert(client);
+        connected_client_count = clients.size();
+        shared_vars::is_renderer_active = true;
+        startup::mark_once("renderer connected");
+        std::cout << "Renderer connected, " << clients.size() << " client(s)" << std::endl;
+
+        client->start();
+
+        // Bring the new client up to date with settings and the current subject
+        for (const auto& [remember_key, message] : remembered_messages) {
+            client->queue(message);
+        }
+
+        accept_next_client();
+    });
+}
+
+void renderer_server::start() {
+    shared_vars::acceptor.open(shared_vars::endpoint.protocol());
+    shared_vars::acceptor.set_option(tcp::acceptor::reuse_address(true));
+    shared_vars::acceptor.bind(shared_vars::endpoint);
+    shared_vars::acceptor.listen();
+
+    accept_next_client();
+
+    server_thread = std::thread([]() {
+        // Keep running while there are no clients to wait on
+        auto work_guard = boost::asio::make_work_guard(shared_vars::io_context);
+        shared_vars::io_context.run();
+    });
+}
+
+void renderer_server::shutdown() {
+    if (!server_thread.joinable()) return;
+
+    std::future<void> closed = all_clients_closed.get_future();
+
+    boost::asio::post(shared_vars::io_context, []() {
+        is_shutting_down = true;
+
+        boost::system::error_code error;
+        shared_vars::acceptor.close(error);
+
+        if (clients.empty()) {
+            all_clients_closed.set_value();
+            return;
+        }
+
+        // Each client closes itself once the quit request is written
+        std::vector<uint8_t> quit_message = renderer_server::make_message(5);
+        for (const std::shared_ptr<renderer_client>& client : clients) {
+            client->queue(quit_message);
+        }
+    });
+
+    if (closed.wait_for(std::chrono::milliseconds(SHUTDOWN_DRAIN_TIMEOUT_MS)) != std::future_status::ready) {
+        std::cout << "Renderer clients did not drain in time, closing anyway" << std::endl;
+    }
+
+    // The sockets belong to the io_context, so they are closed and dropped on
+    // the server thread before it stops rather than left to static destruction
+    boost::asio::post(shared_vars::io_context, []() {
+        for (const std::shared_ptr<renderer_client>& client : clients) {
+            client->close();
+        }
+
+        // Runs after the removals the closes queued
+        boost::asio::post(shared_vars::io_context, []() {
+            clients.clear();
+            connected_client_count = 0;
+            shared_vars::is_renderer_active = false;
+            shared_vars::io_context.stop();
+        });
+    });
+
+    server_thread.join();
+}
+
+void renderer_server::send(std::vector<uint8_t> message) {
+    boost::asio::post(shared_vars::io_context, [message = std::move(message)]() {
+        for (const std::shared_ptr<renderer_client>& client : clients) {
+            client->queue(message);
+        }
+    });
+}
+
+void renderer_server::send_and_remember(std::vector<uint8_t> message, int64_t remember_key) {
+    if (remember_key < 0) {
+        std::memcpy(&remember_key, message.data(), sizeof(remember_key));
+    }
+
+    boost::asio::post(shared_vars::io_context, [remember_key, message]() {
+        remembered_messages[remember_key] = message;
+    });
+    renderer_server::send(std::move(message));
+}
+
+// Newest pose from the CV thread, waiting for the server thread to pick it up
+static std::mutex latest_eye_angles_mutex;
+static std::array<uint8_t, EYE_ANGLES_MESSAGE_SIZE> latest_eye_angles;
+static std::atomic<bool> is_eye_angles_hand_off_posted{false};
+
+// Memory for the one eye angles hand off that can be queued at a time. Asio
+// frees it before running the handler, so it is free again by the next post.
+alignas(std::max_align_t) static unsigned char hand_off_storage[256];
+static std::atomic<bool> is_hand_off_storage_in_use{false};
+
+// Lets the hand off be posted without allocating. Anything that does not fit
+// falls back to the heap.
+template <typename T>
+struct hand_off_allocator {
+    using value_type = T;
+
+    hand_off_allocator() noexcept = default;
+    template <typename U>
+    hand_off_allocator(const hand_off_allocator<U>&) noexcept {}
+
+    T* allocate(size_t count) {
+        size_t size = count * sizeof(T);
+        if (size <= sizeof(hand_off_storage) && !is_hand_off_storage_in_use.exchange(true)) {
+            return reinterpret_cast<T*>(hand_off_storage);
+        }
+        return static_cast<T*>(::operator new(size));
+    }
+
+    void deallocate(T* pointer, size_t) noexcept {
+        if (reinterpret_cast<unsigned char*>(pointer) == hand_off_storage) {
+            is_hand_off_storage_in_use = false;
+        } else {
+            ::operator delete(pointer);
+        }
+    }
+
+    template <typename U>
+    bool operator==(const hand_off_allocator<U>&) const noexcept { return true; }
+    template <typename U>
+    bool operator!=(const hand_off_allocator<U>&) const noexcept { return false; }
+};
+
+// Runs on the server thread and queues the newest pose for every client
+struct eye_angles_hand_off {
+    using allocator_type = hand_off_allocator<void>;
+
+    allocator_type get_allocator() const noexcept {
+        return allocator_type();
+    }
+
+    void operator()() const {
+        // Cleared first, so a pose that arrives from here on posts again
+        is_eye_angles_hand_off_posted = false;
+
+        std::array<uint8_t, EYE_ANGLES_MESSAGE_SIZE> message;
+        {
+            std::lock_guard<std::mutex> lock(latest_eye_angles_mutex);
+            message = latest_eye_angles;
+        }
+
+        for (const std::shared_ptr<renderer_client>& client : clients) {
+            client->queue_eye_angles(message);
+        }
+    }
+};
+
+void renderer_server::send_eye_angles(const double eye_angles[4]) {
+    {
+        std::lock_guard<std::mutex> lock(latest_eye_angles_mutex);
+        int64_t request_code = 4;
+        std::memcpy(latest_eye_angles.data(), &request_code, sizeof(request_code));
+        std::memcpy(latest_eye_angles.data() + sizeof(request_code), eye_angles, 4 * sizeof(double));
+    }
+
+    // A pose that arrives while a hand off is still queued rides along with it
+    if (!is_eye_angles_hand_off_posted.exchange(true)) {
+        boost::asio::post(shared_vars::io_context, eye_angles_hand_off());
+    }
+}
+
+size_t renderer_server::client_count() {
+    return connected_client_count;
+}
+
+std::vector<uint8_t> renderer_server::make_message(int64_t request_code) {
+    std::vector<uint8_t> message;
+    renderer_server::append(message, request_code);
+    return message;
+}
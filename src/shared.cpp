@@ -1,12 +1,12 @@
 #include "shared.hpp"
+#include "renderer_server.hpp"
 
 namespace shared_vars {
     GtkApplication* app = nullptr;
     GtkWidget* main_window = nullptr;
 
-    GdkPaintable* webcam_paintable = nullptr;
+    triple_buffer<tracking_snapshot> tracking_snapshots;
 
-    std::mutex webcam_paintable_mutex;
     cv::VideoCapture webcam_capture;
     Glib::Dispatcher webcam_dispatcher;
     cv::Ptr<cv::FaceDetectorYN> face_detector_pointer;
@@ -25,23 +25,23 @@ namespace shared_vars {
     GtkEditable* vertical_displacement_editable = nullptr;
 
     std::thread cv_process_thread;
-    bool is_current_cv_action_face = true;
+    std::atomic<bool> is_current_cv_action_face{true};
     std::atomic<bool> do_cv_thread_run{true};
 
     boost::asio::io_context io_context;
-    boost::asio::ip::tcp::socket renderer_socket(io_context);
     boost::asio::ip::tcp::endpoint endpoint(boost::asio::ip::address(boost::asio::ip::address_v4(2130706433)), 42842);    
     boost::asio::ip::tcp::acceptor acceptor(io_context);
 
-    bool is_renderer_active = false;
+    std::atomic<bool> is_renderer_active{false};
 
     GtkBuilder *builder = nullptr;
 
     int BUFFER_SIZE = 5;
-    std::queue<double> left_eye_horizontal_angle_buffer;
-    std::queue<double> right_eye_horizontal_angle_buffer;
-    std::queue<double> left_eye_vertical_angle_buffer;
-    std::queue<double> right_eye_vertical_angle_buffer;
+    // Fixed capacity, with room for the push that comes before each pop
+    boost::circular_buffer<double> left_eye_horizontal_angle_buffer(BUFFER_SIZE + 1);
+    boost::circular_buffer<double> right_eye_horizontal_angle_buffer(BUFFER_SIZE + 1);
+    boost::circular_buffer<double> left_eye_vertical_angle_buffer(BUFFER_SIZE + 1);
+    boost::circular_buffer<double> right_eye_vertical_angle_buffer(BUFFER_SIZE + 1);
     double left_eye_horizontal_angle_buffer_sum = 0.0;
     double right_eye_horizontal_angle_buffer_sum = 0.0;
     double left_eye_vertical_angle_buffer_sum = 0.0;
@@ -50,47 +50,43 @@ namespace shared_vars {
     boost::process::child* renderer_program = nullptr;
 }
 
-void shared_vars::listen_for_renderer_socket_and_call_dispatcher() {
-    shared_vars::acceptor.accept(shared_vars::renderer_socket);
-    
-    
-    // Renderer is now connected, load settings, enable flag
-    shared_vars::is_renderer_active = true;
-
-    // Check if settings file exists
-    std::ifstream save_file("calibration_settings.txt");
-    if (save_file.is_open()) {
-        std::string line;
-        
-        try {
-            std::getline(save_file, line);
-            parameters::webcam_fov_deg = std::stof(line);
-            std::getline(save_file, line);
-            parameters::pixels_per_lens = std::stof(line);
-            std::getline(save_file, line);
-            parameters::index_of_refraction = std::stof(line);
-        } catch (const std::invalid_argument& e) {
-            std::cerr << "Invalid settings file: " << e.what() << std::endl;
-        }
-
-        save_file.close();
-
-        // Send these settings to the renderer
-        boost::asio::write(shared_vars::renderer_socket, boost::asio::buffer({(int64_t)2}));
-        boost::asio::write(shared_vars::renderer_socket, boost::asio::buffer({(float_t)parameters::pixels_per_lens}));
-        boost::asio::write(shared_vars::renderer_socket, boost::asio::buffer({(float_t)parameters::index_of_refraction}));
+void shared_vars::send_settings_to_renderer() {
+    std::vector<uint8_t> message = renderer_server::make_message(2);
+    renderer_server::append(message, (float_t)parameters::pixels_per_lens);
+    renderer_server::append(message, (float_t)parameters::index_of_refraction);
+    renderer_server::send_and_remember(std::move(message));
+}
+
+// Adds a value to a moving average buffer, dropping the oldest once it holds
+// BUFFER_SIZE values, and returns the new average
+static double push_to_average(boost::circular_buffer<double>& buffer, double& buffer_sum, double value) {
+    buffer_sum += value;
+    buffer.push_back(value);
+
+    if (buffer.size() > shared_vars::BUFFER_SIZE) {
+        buffer_sum -= buffer.front();
+        buffer.pop_front();
     }
+
+    return buffer_sum / buffer.size();
+}
+
+void shared_vars::filter_eye_angles(const double raw_eye_angles[4], double filtered_eye_angles[4]) {
+    filtered_eye_angles[0] = push_to_average(left_eye_horizontal_angle_buffer, left_eye_horizontal_angle_buffer_sum, raw_eye_angles[0]);
+    filtered_eye_angles[1] = push_to_average(left_eye_vertical_angle_buffer, left_eye_vertical_angle_buffer_sum, raw_eye_angles[1]);
+    filtered_eye_angles[2] = push_to_average(right_eye_horizontal_angle_buffer, right_eye_horizontal_angle_buffer_sum, raw_eye_angles[2]);
+    filtered_eye_angles[3] = push_to_average(right_eye_vertical_angle_buffer, right_eye_vertical_angle_buffer_sum, raw_eye_angles[3]);
 }
 
 namespace working_parameters {
     float qr_code_distance = 0;
-    float qr_code_inverse_proportion = 0;
+    std::atomic<float> qr_code_inverse_proportion{0};
     float lenticule_density = 0;
     float green_to_red_line_distance = 0;
 }
 
 namespace parameters {
-    float webcam_fov_deg = 0;
-    float pixels_per_lens = 0;
-    float index_of_refraction = 1.5;
+    std::atomic<float> webcam_fov_deg{0};
+    std::atomic<float> pixels_per_lens{0};
+    std::atomic<float> index_of_refraction{1.5};
 }
\ No newline at end of file
@@ -0,0 +1,217 @@
+#include "startup.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <string_view>
+#include <thread>
+
+#include <opencv2/core/mat.hpp>
+
+#include "shared.hpp"
+#include "renderer_server.hpp"
+#include "object_cache.hpp"
+#include "camera_model.hpp"
+#include "cv_actions.hpp"
+
+namespace startup {
+    std::shared_future<bool> webcam_ready;
+    std::shared_future<bool> face_detector_ready;
+    std::shared_future<bool> calibration_ready;
+}
+
+// Number of dummy inferences run at each warm up size
+const int WARM_UP_ITERATIONS = 2;
+
+// Size the webcam opens at unless told otherwise. The warm up runs before the
+// webcam is open, and the first real frame sets the input size anyway.
+const cv::Size DEFAULT_CAPTURE_SIZE(640, 480);
+
+static std::chrono::steady_clock::time_point start_time;
+static std::mutex timeline_mutex;
+static std::set<std::string, std::less<>> marked_once_events;
+
+void startup::begin() {
+    start_time = std::chrono::steady_clock::now();
+    startup::mark("activate");
+}
+
+void startup::mark(const std::string& event) {
+    double elapsed_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start_time).count();
+
+    // Formatted on its own stream, so std::cout keeps its precision for
+    // everything else printed, on any thread
+    std::ostringstream elapsed;
+    elapsed << std::fixed << std::setprecision(1) << std::setw(8) << elapsed_ms;
+
+    std::lock_guard<std::mutex> lock(timeline_mutex);
+    std::cout << "[startup +" << elapsed.str() << " ms] " << event << std::endl;
+}
+
+void startup::mark_once(const char* event) {
+    {
+        std::lock_guard<std::mutex> lock(timeline_mutex);
+        if (marked_once_events.find(std::string_view(event)) != marked_once_events.end()) return;
+        marked_once_events.emplace(event);
+    }
+
+    startup::mark(event);
+}
+
+static bool open_webcam() {
+    shared_vars::webcam_capture.open(0);
+    if (!shared_vars::webcam_capture.isOpened()) {
+        std::cerr << "Error: Could not open webcam." << std::endl;
+        return false;
+    }
+    startup::mark("webcam opened");
+
+    // Get a frame and set up bounding box
+    cv::Mat first_frame;
+    shared_vars::webcam_capture >> first_frame;
+    if (first_frame.empty()) {
+        std::cerr << "Error: Could not capture initial frame from webcam." << std::endl;
+        return false;
+    }
+
+    shared_vars::bounding_box = cv::Rect(0, 0, first_frame.cols, first_frame.rows);
+    camera_model::set_frame_size(first_frame.size());
+    startup::mark("first webcam frame");
+
+    return true;
+}
+
+static bool load_face_detector() {
+    try {
+        shared_vars::face_detector_pointer = cv::FaceDetectorYN::create("models/face_detector_model.onnx", "", cv::Size(1, 1), 0.9, 0.3, 1);
+    } catch (const cv::Exception& e) {
+        std::cerr << "Error: Could not load face detector: " << e.what() << std::endl;
+        return false;
+    }
+
+    startup::mark("face detector loaded");
+
+    // Pre-run inference while the webcam is still opening, so the first real
+    // frame does not pay for the backend's lazy allocations
+    for (const cv::Size& size : startup::warm_up_sizes(DEFAULT_CAPTURE_SIZE)) {
+        cv::Mat dummy_frame = cv::Mat::zeros(size, CV_8UC3);
+        cv::Mat output_array;
+
+        shared_vars::face_detector_pointer->setInputSize(size);
+        for (int i = 0; i < WARM_UP_ITERATIONS; i++) {
+            shared_vars::face_detector_pointer->detect(dummy_frame, output_array);
+        }
+    }
+
+    startup::mark("face detector warmed up");
+    return true;
+}
+
+static bool load_calibration_settings() {
+    if (camera_model::load_intrinsics(CAMERA_INTRINSICS_FILE)) {
+        startup::mark("checkerboard camera calibration loaded");
+    }
+
+    // Check if settings file exists
+    std::ifstream save_file("calibration_settings.txt");
+    if (!save_file.is_open()) {
+        startup::mark("no calibration settings found");
+        return false;
+    }
+
+    std::string line;
+
+    try {
+        std::getline(save_file, line);
+        parameters::webcam_fov_deg = std::stof(line);
+        std::getline(save_file, line);
+        parameters::pixels_per_lens = std::stof(line);
+        std::getline(save_file, line);
+        parameters::index_of_refraction = std::stof(line);
+    } catch (const std::logic_error& e) {
+        // std::stof throws invalid_argument or out_of_range
+        std::cerr << "Invalid settings file: " << e.what() << std::endl;
+        return false;
+    }
+
+    startup::mark("calibration settings loaded");
+    camera_model::use_horizontal_fov(parameters::webcam_fov_deg);
+
+    // Queued until renderers connect
+    shared_vars::send_settings_to_renderer();
+    return true;
+}
+
+void startup::launch_background_tasks() {
+    startup::webcam_ready = std::async(std::launch::async, open_webcam).share();
+    startup::face_detector_ready = std::async(std::launch::async, load_face_detector).share();
+    startup::calibration_ready = std::async(std::launch::async, load_calibration_settings).share();
+
+    // Maps recently used subjects in the background
+    object_cache::start();
+}
+
+// Runs on the GTK thread once the renderer process has exited
+static gboolean quit_after_renderer_exit(gpointer) {
+    std::cout << "Renderer program exited, quitting" << std::endl;
+    g_application_quit(G_APPLICATION(shared_vars::app));
+    return G_SOURCE_REMOVE;
+}
+
+void startup::start_renderer() {
+    renderer_server::start();
+
+    shared_vars::renderer_program = new boost::process::child("renderer");
+    startup::mark("renderer spawned");
+
+    // Closing the display quits the app. Socket clients may be test tools,
+    // so the spawned process exiting is the signal rather than a disconnect.
+    // Detached, since the process is only waited on and may outlive the app.
+    std::thread([]() {
+        std::error_code error;
+        shared_vars::renderer_program->wait(error);
+        g_idle_add(quit_after_renderer_exit, nullptr);
+    }).detach();
+}
+
+std::vector<cv::Size> startup::warm_up_sizes(cv::Size frame_size) {
+    // Once a face is found the search area shrinks to around the face, which
+    // is usually somewhere between a quarter and a half of the frame height.
+    // Search areas are sized the same way detect_face sizes them.
+    std::vector<cv::Size> sizes;
+
+    for (int divisor : {4, 2}) {
+        int face_side = frame_size.height / divisor;
+        int needed_side = (int)std::ceil(face_side * SEARCH_AREA_SIZE);
+        cv::Size size(
+            cv_actions::stable_search_side(needed_side, 0, frame_size.width),
+            cv_actions::stable_search_side(needed_side, 0, frame_size.height)
+        );
+        if (size.width < 63 || size.height < 63) continue; // Minimum size for the face detector
+        if (std::find(sizes.begin(), sizes.end(), size) == sizes.end()) sizes.push_back(size);
+    }
+
+    // The detector only keeps the input shape it last ran at. The first real
+    // search is over the full frame, so that goes last.
+    sizes.push_back(frame_size);
+
+    return sizes;
+}
+
+bool startup::wait_for_cv_dependencies() {
+    startup::webcam_ready.get();
+
+    if (!startup::face_detector_ready.get()) {
+        return false;
+    }
+
+    // Settings are read before the first pose, so its angles use the
+    // calibrated field of view
+    startup::calibration_ready.get();
+
+    return true;
+}
@@ -0,0 +1,179 @@
+/*
+Allocation test. Checks that the calls the CV loop makes every frame stop
+allocating once they have warmed up. Built with COUNT_FRAME_ALLOCATIONS, and
+run by ctest from the build directory. Exits non zero if any of them allocated.
+
+Two allocations in a frame are outside this code and are not held to zero:
+    - The face detector. OpenCV's DNN module allocates for its layers and its
+      thread pool jobs on every forward pass. detect_face is instead checked
+      to add nothing on top of a bare detector call at the same input size.
+    - The webcam capture. VideoCapture's backend buffers depend on the driver
+      and there is no webcam in a test run. The frame it decodes into is
+      reused by the CV loop, as it is here.
+*/
+
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <thread>
+
+#include <boost/asio.hpp>
+#include <gtk/gtk.h>
+#include <opencv2/core.hpp>
+
+#include "allocation_counter.hpp"
+#include "camera_model.hpp"
+#include "cv_actions.hpp"
+#include "frame_pool.hpp"
+#include "motion_gate.hpp"
+#include "pose_recorder.hpp"
+#include "renderer_server.hpp"
+#include "shared.hpp"
+#include "triple_buffer.hpp"
+
+// Calls made before counting, so buffers and pools can fill up
+const int WARM_UP_ITERATIONS = 100;
+
+// Calls counted. Kept under the motion gate's skip report interval, which prints.
+const int CHECKED_ITERATIONS = 200;
+
+// Detection is slow, so it gets fewer calls
+const int DETECTOR_WARM_UP_ITERATIONS = 3;
+const int DETECTOR_CHECKED_ITERATIONS = 10;
+
+const char* TEST_POSE_LOG = "allocation_test.poselog";
+
+static int failures = 0;
+
+// Runs step warm up times, then returns the allocations made by the checked calls
+template <typename Step>
+static uint64_t count_allocations(Step step, int warm_up_iterations, int checked_iterations) {
+    for (int i = 0; i < warm_up_iterations; i++) {
+        step(i);
+    }
+
+    uint64_t allocations_before = allocation_counter::thread_count();
+    for (int i = warm_up_iterations; i < warm_up_iterations + checked_iterations; i++) {
+        step(i);
+    }
+    return allocation_counter::thread_count() - allocations_before;
+}
+
+static void expect_at_most(const char* name, uint64_t allocations, uint64_t allowed_allocations, int calls) {
+    if (allocations <= allowed_allocations) {
+        std::cout << "PASS " << name << std::endl;
+    } else {
+        std::cerr << "FAIL " << name << ": " << allocations << " allocations in "
+            << calls << " calls, expected at most " << allowed_allocations << std::endl;
+        failures++;
+    }
+}
+
+template <typename Step>
+static void expect_no_allocations(const char* name, Step step) {
+    expect_at_most(name, count_allocations(step, WARM_UP_ITERATIONS, CHECKED_ITERATIONS), 0, CHECKED_ITERATIONS);
+}
+
+int main() {
+    if (!allocation_counter::is_enabled()) {
+        std::cerr << "Build with COUNT_FRAME_ALLOCATIONS to run this test" << std::endl;
+        return 1;
+    }
+    allocation_counter::install();
+
+    cv::Mat frame(480, 640, CV_8UC3, cv::Scalar(40, 90, 160));
+
+    triple_buffer<tracking_snapshot> snapshots;
+    expect_no_allocations("triple_buffer::publish", [&](int) {
+        snapshots.back().paintable = nullptr;
+        snapshots.publish();
+        snapshots.acquire();
+    });
+
+    camera_model::use_horizontal_fov(60);
+    camera_model::set_frame_size(frame.size());
+    expect_no_allocations("camera_model::angles_at", [&](int i) {
+        camera_model::angles_at(cv::Point2f((float)(i % frame.cols), (float)(i % frame.rows)), frame.size());
+    });
+
+    expect_no_allocations("shared_vars::filter_eye_angles", [](int i) {
+        double raw_eye_angles[4] = {(double)i, -(double)i, 0.5 * i, -0.5 * i};
+        double filtered_eye_angles[4];
+        shared_vars::filter_eye_angles(raw_eye_angles, filtered_eye_angles);
+    });
+
+    // Records are written on the recorder's own thread, which is not counted
+    if (pose_recorder::start(TEST_POSE_LOG)) {
+        expect_no_allocations("pose_recorder::record", [](int i) {
+            pose_record record = {};
+            record.flags = POSE_RECORD_HAS_POSE;
+            record.raw_eye_angles[0] = i;
+            pose_recorder::record(record);
+        });
+        pose_recorder::stop();
+        std::remove(TEST_POSE_LOG);
+    } else {
+        failures++;
+    }
+
+    // Hand offs run here, as they would on the server thread. No clients
+    // connect, so they only take the pose.
+    std::thread server_thread([]() {
+        auto work_guard = boost::asio::make_work_guard(shared_vars::io_context);
+        shared_vars::io_context.run();
+    });
+
+    expect_no_allocations("renderer_server::send_eye_angles", [](int i) {
+        double eye_angles[4] = {(double)i, -(double)i, 0.5 * i, -0.5 * i};
+        renderer_server::send_eye_angles(eye_angles);
+    });
+
+    shared_vars::io_context.stop();
+    server_thread.join();
+
+    frame_pool preview_frames(4);
+    expect_no_allocations("frame_pool::to_paintable", [&](int) {
+        GdkPaintable* paintable = preview_frames.to_paintable(frame);
+        g_object_unref(paintable);
+    });
+
+    // Mostly still frames, with a change now and then so the detection path
+    // is checked too. The search area moves and changes size by a few pixels.
+    cv::Mat moved_frame(480, 640, CV_8UC3, cv::Scalar(40, 90, 160));
+    moved_frame(cv::Rect(240, 160, 160, 160)).setTo(cv::Scalar(200, 200, 200));
+    expect_no_allocations("motion_gate::is_static", [&](int i) {
+        cv::Rect search_bounds(200 + i % 3, 120, 256 + i % 8, 256 - i % 5);
+        motion_gate::is_static(i % 40 == 0 ? moved_frame : frame, search_bounds);
+    });
+
+    // The search area is the full frame, which is also what detect_face resets
+    // it to when no face is found, so the detector input size stays fixed.
+    // At detector scale 1 the search area goes to the detector unscaled.
+    cv::Ptr<cv::FaceDetectorYN> face_detector;
+    try {
+        face_detector = cv::FaceDetectorYN::create("models/face_detector_model.onnx", "", frame.size(), 0.9, 0.3, 1);
+    } catch (const cv::Exception& e) {
+        std::cerr << "FAIL could not load the face detector: " << e.what() << std::endl;
+        return 1;
+    }
+
+    cv::Mat detections;
+    uint64_t detector_allocations = count_allocations([&](int) {
+        face_detector->detect(frame, detections);
+    }, DETECTOR_WARM_UP_ITERATIONS, DETECTOR_CHECKED_ITERATIONS);
+
+    cv::Mat detection_frame = frame.clone();
+    cv::Rect search_bounds(0, 0, frame.cols, frame.rows);
+    cv_actions::face_detection_buffers detection_buffers;
+    cv_actions::face_detection_stats stats;
+    cv_actions::face_markers markers;
+    uint64_t detect_face_allocations = count_allocations([&](int) {
+        cv::Point2f left_eye_position;
+        cv::Point2f right_eye_position;
+        cv_actions::detect_face(face_detector, search_bounds, detection_frame, left_eye_position, right_eye_position, 1.0f, SEARCH_AREA_SIZE, detection_buffers, stats, markers);
+    }, DETECTOR_WARM_UP_ITERATIONS, DETECTOR_CHECKED_ITERATIONS);
+
+    expect_at_most("cv_actions::detect_face beyond the detector", detect_face_allocations, detector_allocations, DETECTOR_CHECKED_ITERATIONS);
+
+    return failures == 0 ? 0 : 1;
+}